@@ -0,0 +1,72 @@
+/*
+  ==============================================================================
+
+    AllocationGuard.cpp
+
+  ==============================================================================
+*/
+
+#include <cstdlib>
+#include <new>
+
+#include <JuceHeader.h>
+#include "AllocationGuard.h"
+
+namespace AllocationGuard
+{
+    std::atomic<int> violations { 0 };
+
+    static thread_local int noAllocationDepth = 0;
+
+#if JV880_ASSERT_NO_ALLOC
+    ScopedNoAllocation::ScopedNoAllocation()  { noAllocationDepth++; }
+    ScopedNoAllocation::~ScopedNoAllocation() { noAllocationDepth--; }
+
+    static void checkAllocation()
+    {
+        if (noAllocationDepth == 0)
+            return;
+
+        // the assertion may log, which allocates again
+        int depth = noAllocationDepth;
+        noAllocationDepth = 0;
+        violations++;
+        jassertfalse;
+        noAllocationDepth = depth;
+    }
+#else
+    ScopedNoAllocation::ScopedNoAllocation()  {}
+    ScopedNoAllocation::~ScopedNoAllocation() {}
+#endif
+}
+
+#if JV880_ASSERT_NO_ALLOC
+void* operator new (std::size_t size)
+{
+    AllocationGuard::checkAllocation();
+    if (void* p = std::malloc (size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)
+{
+    return operator new (size);
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+    AllocationGuard::checkAllocation();
+    return std::malloc (size != 0 ? size : 1);
+}
+
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new (size, std::nothrow);
+}
+
+void operator delete (void* p) noexcept                { std::free (p); }
+void operator delete[] (void* p) noexcept              { std::free (p); }
+void operator delete (void* p, std::size_t) noexcept   { std::free (p); }
+void operator delete[] (void* p, std::size_t) noexcept { std::free (p); }
+#endif
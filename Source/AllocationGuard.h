@@ -0,0 +1,40 @@
+/*
+  ==============================================================================
+
+    AllocationGuard.h
+
+    Heap allocation checks for the audio thread. With JV880_ASSERT_NO_ALLOC
+    (on in debug builds) the global operator new is replaced: it then
+    asserts while a ScopedNoAllocation is alive on the calling thread, and
+    counts the allocation in violations. Otherwise ScopedNoAllocation does
+    nothing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+
+#include <JuceHeader.h>
+
+#ifndef JV880_ASSERT_NO_ALLOC
+ #if JUCE_DEBUG
+  #define JV880_ASSERT_NO_ALLOC 1
+ #else
+  #define JV880_ASSERT_NO_ALLOC 0
+ #endif
+#endif
+
+namespace AllocationGuard
+{
+    // allocations made inside a ScopedNoAllocation, on any thread,
+    // reported and cleared by releaseResources
+    extern std::atomic<int> violations;
+
+    struct ScopedNoAllocation
+    {
+        ScopedNoAllocation();
+        ~ScopedNoAllocation();
+    };
+}
@@ -9,6 +9,7 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "AllocationGuard.h"
 
 static std::vector<const uint8_t *> expansions = {
     (const uint8_t*)BinaryData::rd500_expansion_bin,
@@ -72,6 +73,8 @@ Jv880_juceAudioProcessor::Jv880_juceAudioProcessor()
     mcu->startSC55(BinaryData::jv880_rom1_bin, BinaryData::jv880_rom2_bin,
                    BinaryData::jv880_waverom1_bin, BinaryData::jv880_waverom2_bin,
                    BinaryData::jv880_nvram_bin);
+    mcu->engine_mode = MCU_ENGINE_SCHEDULED;
+    mcu->pcm.engine = PCM_ENGINE_VECTOR;
 
     //std::vector<std::pair<size_t, const char *>> descrambleList = {
     //    { 2, "SR-JV80-01 Pop - CS 0x3F1CF705.bin" },
@@ -267,7 +270,6 @@ Jv880_juceAudioProcessor::Jv880_juceAudioProcessor()
 
 Jv880_juceAudioProcessor::~Jv880_juceAudioProcessor()
 {
-    memset(mcu, 0, sizeof(MCU));
     delete mcu;
 }
 
@@ -312,11 +314,14 @@ void Jv880_juceAudioProcessor::setCurrentProgram (int index)
     if (index < 0 || index >= getNumPrograms())
         return;
 
+    // the render-ahead worker must not run the MCU meanwhile
+    mcu->render_ahead.RENDERAHEAD_Pause();
+
     int expansionI = patchInfos[index]->expansionI;
     if (expansionI != 0xff && status.currentExpansion != expansionI)
     {
         status.currentExpansion = expansionI;
-        memcpy(mcu->pcm.waverom_exp, expansionsDescr[expansionI], 0x800000);
+        mcu->pcm.PCM_SetExpansion(expansionsDescr[expansionI]);
         mcu->SC55_Reset();
     }
 
@@ -346,6 +351,8 @@ void Jv880_juceAudioProcessor::setCurrentProgram (int index)
             mcu->postMidiSC55(buffer, sizeof(buffer));
         }
     }
+
+    mcu->render_ahead.RENDERAHEAD_Resume();
 }
 
 const juce::String Jv880_juceAudioProcessor::getProgramName (int index)
@@ -360,14 +367,34 @@ void Jv880_juceAudioProcessor::changeProgramName (int index, const juce::String&
 //==============================================================================
 void Jv880_juceAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    // Use this method as the place to do any pre-playback
-    // initialisation that you need..
+    // everything that depends on the rate or the block size, processBlock
+    // must not allocate
+    mcu->render_ahead.RENDERAHEAD_Stop();
+    mcu->resampler_quality = isNonRealtime() ? RESAMPLER_QUALITY_MASTERING : status.resamplerQuality;
+    mcu->pcm.output_mode = status.pcmOutputMode;
+
+    if (status.renderAheadLatency > 0 && ! isNonRealtime())
+    {
+        setLatencySamples (mcu->render_ahead.RENDERAHEAD_Start ((int)sampleRate, samplesPerBlock, status.renderAheadLatency));
+    }
+    else
+    {
+        mcu->MCU_PrepareOutput((int)sampleRate, samplesPerBlock);
+        setLatencySamples (0);
+    }
 }
 
 void Jv880_juceAudioProcessor::releaseResources()
 {
-    // When playback stops, you can use this as an opportunity to free up any
-    // spare memory, etc.
+    mcu->render_ahead.RENDERAHEAD_Stop();
+
+#if JV880_ASSERT_NO_ALLOC
+    if (int violations = AllocationGuard::violations.exchange (0))
+    {
+        DBG ("processBlock allocated " << violations << " times");
+        jassertfalse;
+    }
+#endif
 }
 
 bool Jv880_juceAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
@@ -380,15 +407,28 @@ bool Jv880_juceAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
 
 void Jv880_juceAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    AllocationGuard::ScopedNoAllocation noAllocation;
+    const bool renderAhead = mcu->render_ahead.running;
+
     for (const auto metadata : midiMessages)
     {
-        auto message = metadata.getMessage();
-        if (status.isDrums)
-            message.setChannel(10);
-        else
-            message.setChannel(1);
-        int samplePos = (double)metadata.samplePosition / getSampleRate() * 64000;
-        mcu->enqueueMidiSC55(message.getRawData(), message.getRawDataSize(), samplePos);
+        // rechannelled in a copy, a MidiMessage allocates for sysex
+        const uint8_t* data = metadata.data;
+        int length = metadata.numBytes;
+        uint8_t message[3];
+        if (length > 0 && length <= 3 && (data[0] & 0xf0) != 0xf0)
+        {
+            memcpy(message, data, length);
+            message[0] = (message[0] & 0xf0) | (status.isDrums ? 9 : 0);
+            data = message;
+        }
+        if (renderAhead)
+        {
+            mcu->render_ahead.RENDERAHEAD_PostMidi(data, length, metadata.samplePosition);
+            continue;
+        }
+        int samplePos = (double)metadata.samplePosition / getSampleRate() * mcu->MCU_GetSampleRate();
+        mcu->enqueueMidiSC55(data, length, samplePos);
     }
  
     juce::ScopedNoDenormals noDenormals;
@@ -400,7 +440,22 @@ void Jv880_juceAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
 
     float* channelDataL = buffer.getWritePointer(0);
     float* channelDataR = buffer.getWritePointer(1);
+
+    if (renderAhead)
+    {
+        // the worker owns the MCU, an offline render waits for it
+        mcu->render_ahead.RENDERAHEAD_Read(channelDataL, channelDataR, buffer.getNumSamples(), isNonRealtime());
+        return;
+    }
+
+    mcu->resampler_quality = isNonRealtime() ? RESAMPLER_QUALITY_MASTERING : status.resamplerQuality;
     mcu->updateSC55WithSampleRate(channelDataL, channelDataR, buffer.getNumSamples(), getSampleRate());
+
+#if JV880_ASSERT_NO_ALLOC
+    // the emulator allocates with malloc, which operator new doesn't see
+    jassert (mcu->output_allocations == 0);
+    mcu->output_allocations = 0;
+#endif
 }
 
 //==============================================================================
@@ -427,16 +482,22 @@ void Jv880_juceAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 
 void Jv880_juceAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    memcpy(&status, data, sizeof(DataToSave));
+    status = DataToSave();
+    memcpy(&status, data, std::min<size_t>(sizeInBytes, sizeof(DataToSave)));
+    status.resamplerQuality = juce::jlimit<int>(RESAMPLER_QUALITY_DRAFT, RESAMPLER_QUALITY_MASTERING, status.resamplerQuality);
+    status.renderAheadLatency = juce::jmax(0, status.renderAheadLatency);
+    status.pcmOutputMode = juce::jlimit<int>(PCM_OUTPUT_OVERSAMPLED, PCM_OUTPUT_SINGLE, status.pcmOutputMode);
 
+    mcu->render_ahead.RENDERAHEAD_Pause();
     mcu->nvram[0x0d] |= 1 << 5; // LastSet
     mcu->nvram[0x00] = status.masterTune;
     mcu->nvram[0x02] = status.reverbEnabled | status.chorusEnabled << 1;
 
-    memcpy(mcu->pcm.waverom_exp, expansionsDescr[status.currentExpansion], 0x800000);
+    mcu->pcm.PCM_SetExpansion(expansionsDescr[status.currentExpansion]);
     mcu->nvram[0x11] = status.isDrums ? 0 : 1;
     memcpy(&mcu->nvram[0x67f0], status.drums, 0xa7c);
     memcpy(&mcu->nvram[0x0d70], status.patch, 0x16a);
+    mcu->render_ahead.RENDERAHEAD_Resume();
 }
 
 void Jv880_juceAudioProcessor::sendSysexParamChange(uint32_t address, uint8_t value)
@@ -468,7 +529,7 @@ void Jv880_juceAudioProcessor::sendSysexParamChange(uint32_t address, uint8_t va
     buf[10] = checksum;
     buf[11] = 0xf7;
 
-    mcu->postMidiSC55(buf, 12);
+    mcu->render_ahead.RENDERAHEAD_PostControl(buf, 12);
 }
 
 //==============================================================================
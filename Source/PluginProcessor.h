@@ -80,6 +80,18 @@ public:
         bool isDrums = false;
         uint8_t patch[0x16a] = {0};
         uint8_t drums[0xa7c] = {0};
+
+        // added later, states saved before keep the defaults
+        // resampler tier for live playback, offline renders always use mastering
+        int resamplerQuality = RESAMPLER_QUALITY_NORMAL;
+        // output frames the emulator runs ahead on a worker thread, reported
+        // as latency. 0 renders in processBlock, values too small for the
+        // block size are raised to the minimum. Not used for offline renders,
+        // applied by prepareToPlay
+        int renderAheadLatency = 0;
+        // PCM_OUTPUT_*, the rate the emulator renders at. Applied by
+        // prepareToPlay
+        int pcmOutputMode = PCM_OUTPUT_OVERSAMPLED;
     };
 
     DataToSave status;
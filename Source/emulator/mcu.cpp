@@ -35,6 +35,7 @@
 #include <string.h>
 #include <math.h>
 #include <chrono>
+#include <algorithm>
 #include "mcu.h"
 #include "mcu_opcodes.h"
 #include "mcu_interrupt.h"
@@ -42,6 +43,7 @@
 #include "pcm.h"
 #include "lcd.h"
 #include "submcu.h"
+#include "mcu_profiler.h"
 #include "resample/libresample.h"
 
 #if __linux__
@@ -138,6 +140,7 @@ void MCU::MCU_ControlRegisterWrite(uint32_t reg, uint32_t siz, uint32_t data)
         {
             mcu.sr = data;
             mcu.sr &= sr_mask;
+            mcu.status_op = STATUS_OP_NONE;
         }
         else if (reg == 5) // FIXME: undocumented
         {
@@ -163,6 +166,7 @@ void MCU::MCU_ControlRegisterWrite(uint32_t reg, uint32_t siz, uint32_t data)
             mcu.sr &= ~0xff;
             mcu.sr |= data & 0xff;
             mcu.sr &= sr_mask;
+            mcu.status_op = STATUS_OP_NONE;
         }
         else if (reg == 3)
         {
@@ -194,7 +198,7 @@ uint32_t MCU::MCU_ControlRegisterRead(uint32_t reg, uint32_t siz)
     {
         if (reg == 0)
         {
-            ret = mcu.sr & sr_mask;
+            ret = MCU_GetSR() & sr_mask;
         }
         else if (reg == 5) // FIXME: undocumented
         {
@@ -218,7 +222,7 @@ uint32_t MCU::MCU_ControlRegisterRead(uint32_t reg, uint32_t siz)
     {
         if (reg == 1)
         {
-            ret = mcu.sr & sr_mask;
+            ret = MCU_GetSR() & sr_mask;
         }
         else if (reg == 3)
         {
@@ -247,12 +251,58 @@ uint32_t MCU::MCU_ControlRegisterRead(uint32_t reg, uint32_t siz)
 
 void MCU::MCU_SetStatus(uint32_t condition, uint32_t mask)
 {
+    if (mcu.status_op != STATUS_OP_NONE)
+        MCU_EvaluateStatus();
     if (condition)
         mcu.sr |= mask;
     else
         mcu.sr &= ~mask;
 }
 
+void MCU::MCU_EvaluateStatus(void)
+{
+    int32_t bits = mcu.status_siz ? 16 : 8;
+    int32_t sign = 1 << (bits - 1);
+    int32_t t1 = mcu.status_t1;
+    int32_t t2 = mcu.status_t2;
+    int32_t st1 = (t1 ^ sign) - sign;
+    int32_t st2 = (t2 ^ sign) - sign;
+    int32_t c_bit = mcu.status_c_bit;
+    int32_t N, Z, C, V;
+    switch (mcu.status_op)
+    {
+    case STATUS_OP_ADD:
+        t1 += t2 + c_bit;
+        st1 += st2 + c_bit;
+        C = (t1 >> bits) & 1;
+        break;
+    case STATUS_OP_SUB:
+        t1 -= t2 + c_bit;
+        st1 -= st2 + c_bit;
+        C = (t1 >> bits) & 1;
+        break;
+    default: // STATUS_OP_LOGIC
+        st1 = 0;
+        C = (mcu.sr & STATUS_C) != 0;
+        break;
+    }
+    t1 &= (1 << bits) - 1;
+    N = (t1 & sign) != 0;
+    Z = t1 == 0;
+    V = st1 < -sign || st1 >= sign;
+
+    mcu.sr &= ~(STATUS_N | STATUS_Z | STATUS_V | STATUS_C);
+    if (N)
+        mcu.sr |= STATUS_N;
+    if (Z)
+        mcu.sr |= STATUS_Z;
+    if (V)
+        mcu.sr |= STATUS_V;
+    if (C)
+        mcu.sr |= STATUS_C;
+    mcu.status_op = STATUS_OP_NONE;
+}
+
 void MCU::MCU_PushStack(uint16_t data)
 {
     if (mcu.r[7] & 1)
@@ -473,6 +523,10 @@ void MCU::MCU_DeviceWrite(uint32_t address, uint8_t data)
         break;
     }
     dev_register[address] = data;
+    if (address == DEV_RAME)
+        MCU_UpdateMemoryMap();
+    else if (address == DEV_P1CR || (address >= DEV_IPRA && address <= DEV_IPRD))
+        MCU_Interrupt_UpdatePriority(this);
 }
 
 uint8_t MCU::MCU_DeviceRead(uint32_t address)
@@ -567,6 +621,7 @@ void MCU::MCU_DeviceReset(void)
     // dev_register[0x7c] = 0x87;
     dev_register[DEV_RAME] = 0x80;
     dev_register[DEV_SSR] = 0x80;
+    MCU_UpdateMemoryMap();
 }
 
 void MCU::MCU_UpdateAnalog(uint64_t cycles)
@@ -602,8 +657,9 @@ void MCU::MCU_UpdateAnalog(uint64_t cycles)
         analog_end_time = 0;
 }
 
-uint8_t MCU::MCU_Read(uint32_t address)
+uint8_t MCU::MCU_ReadIO(uint32_t address)
 {
+    io_access = 1;
     uint32_t address_rom = address & 0x3ffff;
     if (address & 0x80000 && !mcu_jv880)
         address_rom |= 0x40000;
@@ -784,6 +840,85 @@ uint8_t MCU::MCU_Read(uint32_t address)
     return ret;
 }
 
+// Mirrors the decoding in MCU_ReadIO/MCU_WriteIO: blocks that are plain
+// memory get a host pointer, everything with side effects stays on the slow path.
+void MCU::MCU_UpdateMemoryMap(void)
+{
+    int rame = (dev_register[DEV_RAME] & 0x80) != 0;
+    uint16_t base = mcu_jv880 ? 0xf000 : 0xe000;
+    for (int i = 0; i < MEMORY_MAP_SIZE; i++)
+    {
+        uint32_t address = i << MEMORY_MAP_SHIFT;
+        uint32_t address_rom = address & 0x3ffff;
+        if (address & 0x80000 && !mcu_jv880)
+            address_rom |= 0x40000;
+        uint8_t page = (address >> 16) & 0xf;
+        address &= 0xffff;
+        uint8_t *rd = nullptr;
+        uint8_t *wr = nullptr;
+        switch (page)
+        {
+        case 0:
+            if (!(address & 0x8000))
+                rd = &rom1[address & 0x7fff];
+            else if (address >= 0xfb80 && address < 0xff80 && rame)
+                rd = wr = &ram[(address - 0xfb80) & 0x3ff];
+            else if (address >= 0x8000 && address < 0xe000)
+                rd = wr = &sram[address & 0x7fff];
+            if (!mcu_mk1)
+            {
+                if (address >= base && address < (base | 0x800))
+                    rd = wr = nullptr;
+                if (!mcu_scb55 && address >= 0xec00 && address < 0xf000)
+                    rd = wr = nullptr;
+            }
+            else if (address >= 0xe000 && address < 0xe040)
+                rd = wr = nullptr;
+            break;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+            rd = &rom2[address_rom & rom2_mask];
+            break;
+        case 8:
+        case 9:
+            if (!mcu_jv880)
+                rd = &rom2[address_rom & rom2_mask];
+            break;
+        case 14:
+        case 15:
+            if (!mcu_jv880)
+                rd = &rom2[address_rom & rom2_mask];
+            else
+                rd = &cardram[address & 0x7fff];
+            if (page == 14 && mcu_jv880)
+                wr = rd;
+            break;
+        case 10:
+        case 11:
+            if (!mcu_mk1)
+                rd = &sram[address & 0x7fff];
+            if (page == 10 && !mcu_mk1)
+                wr = rd;
+            break;
+        case 12:
+        case 13:
+            if (mcu_jv880)
+                rd = &nvram[address & 0x7fff];
+            if (page == 12 && mcu_jv880)
+                wr = rd;
+            break;
+        case 5:
+            if (mcu_mk1)
+                rd = wr = &sram[address & 0x7fff];
+            break;
+        }
+        read_map[i] = rd;
+        write_map[i] = wr;
+    }
+}
+
 uint16_t MCU::MCU_Read16(uint32_t address)
 {
     address &= ~1;
@@ -804,8 +939,9 @@ uint32_t MCU::MCU_Read32(uint32_t address)
     return (b0 << 24) + (b1 << 16) + (b2 << 8) + b3;
 }
 
-void MCU::MCU_Write(uint32_t address, uint8_t value)
+void MCU::MCU_WriteIO(uint32_t address, uint8_t value)
 {
+    io_access = 1;
     uint8_t page = (address >> 16) & 0xf;
     address &= 0xffff;
     if (page == 0)
@@ -947,16 +1083,47 @@ void MCU::MCU_Write16(uint32_t address, uint16_t value)
     MCU_Write(address + 1, value & 0xff);
 }
 
-void MCU::MCU_ReadInstruction(void)
+// Returns the number of states the instruction took
+uint32_t MCU::MCU_ReadInstruction(void)
 {
-    uint8_t operand = MCU_ReadCodeAdvance();
+    uint32_t page = mcu.cp & 0xf;
+    uint32_t tag = (mcu.cp << 16) | mcu.pc;
+    uint32_t states;
+    mcu_decode_t uncached;
+    mcu_decode_t *decode;
+
+    // only code in rom1/rom2 is cached, anything fetched from ram is decoded every time
+    if ((page == 0 && mcu.pc < ROM1_SIZE - 8) || (page >= 1 && page <= 4))
+    {
+        decode = &decode_cache[(mcu.pc ^ (page << 11)) & (DECODE_CACHE_SIZE - 1)];
+        if (decode->tag == tag)
+        {
+            mcu.pc += decode->length;
+        }
+        else
+        {
+            MCU_Operand_Decode(this, decode);
+            decode->tag = tag;
+        }
+    }
+    else
+    {
+        decode = &uncached;
+        MCU_Operand_Decode(this, decode);
+    }
+    states = MCU_Operand_Execute(this, decode);
 
-    MCU_Operand_Table[operand](this, operand);
+#ifdef MCU_PROFILER
+    if (profiler.enabled)
+        profiler.PROFILER_Instruction(tag, decode, MCU_StepCycles(states));
+#endif
 
     if (mcu.sr & STATUS_T)
     {
         MCU_Interrupt_Exception(this, EXCEPTION_SOURCE_TRACE);
     }
+
+    return states;
 }
 
 void MCU::MCU_Init(void)
@@ -978,6 +1145,7 @@ void MCU::MCU_Reset(void)
     mcu.pc = 0;
 
     mcu.sr = 0x700;
+    mcu.status_op = STATUS_OP_NONE;
 
     mcu.cp = 0;
     mcu.dp = 0;
@@ -990,6 +1158,7 @@ void MCU::MCU_Reset(void)
     mcu.pc = reset_address & 0xffff;
 
     mcu.exception_pending = -1;
+    MCU_Interrupt_UpdatePriority(this);
 
     MCU_DeviceReset();
 
@@ -1052,6 +1221,12 @@ void MCU::MCU_PatchROM(void)
     rom2[0x318f7] = 0x19;
 }
 
+void MCU::MCU_InvalidateDecodeCache(void)
+{
+    for (int i = 0; i < DECODE_CACHE_SIZE; i++)
+        decode_cache[i].tag = DECODE_TAG_INVALID;
+}
+
 uint8_t MCU::MCU_ReadP0(void)
 {
     return 0xff;
@@ -1111,11 +1286,16 @@ void unscramble(uint8_t *src, uint8_t *dst, int len)
     }
 }
 
-void MCU::MCU_PostSample(int *sample)
+// Converts the samples of a block to float in one pass. Scaling by a power
+// of two after the conversion rounds the same as dividing in double.
+void MCU::MCU_ConvertSamples(int count)
 {
-    sample_buffer_l[sample_write_ptr] = sample[0] / 2147483648.0;
-    sample_buffer_r[sample_write_ptr] = sample[1] / 2147483648.0;
-    sample_write_ptr = (sample_write_ptr + 1) % audio_buffer_size;
+    const float scale = 1.0f / 2147483648.0f;
+    for (int i = 0; i < count; i++)
+    {
+        sample_buffer_l[i] = sample_buffer[i][0] * scale;
+        sample_buffer_r[i] = sample_buffer[i][1] * scale;
+    }
 }
 
 void MCU::MCU_GA_SetGAInt(int line, int value)
@@ -1138,53 +1318,42 @@ void MCU::MCU_EncoderTrigger(int dir)
     MCU_GA_SetGAInt(dir == 0 ? 3 : 4, 1);
 }
 
-MCU::MCU() : pcm(this), lcd(this), mcu_timer(this), sub_mcu(this) {}
+MCU::MCU() : pcm(this), lcd(this), mcu_timer(this), sub_mcu(this)
+#ifdef MCU_PROFILER
+    , profiler(this)
+#endif
+    , render_ahead(this)
+{}
+
+MCU::~MCU()
+{
+    // the worker runs the whole MCU
+    render_ahead.RENDERAHEAD_Stop();
+}
 
 int MCU::startSC55(const char* s_rom1, const char* s_rom2, const char* s_waverom1, const char* s_waverom2, const char* s_nvram)
 {
     uint8_t* tempbuf = (uint8_t*) malloc(0x800000);
 
+#ifndef MCU_ROMSET
     romset = ROM_SET_JV880;
 
-    mcu_mk1 = false;
-    mcu_cm300 = false;
-    mcu_st = false;
-    mcu_jv880 = false;
-    mcu_scb55 = false;
-    mcu_sc155 = false;
-    switch (romset)
+    const mcu_romset_traits_t traits = MCU_GetRomsetTraits(romset);
+    mcu_mk1 = traits.mk1;
+    mcu_cm300 = traits.cm300;
+    mcu_st = traits.st;
+    mcu_jv880 = traits.jv880;
+    mcu_scb55 = traits.scb55;
+    mcu_sc155 = traits.sc155;
+#endif
+
+    if (mcu_jv880)
     {
-        case ROM_SET_MK2:
-        case ROM_SET_SC155MK2:
-            if (romset == ROM_SET_SC155MK2)
-                mcu_sc155 = true;
-            break;
-        case ROM_SET_ST:
-            mcu_st = true;
-            break;
-        case ROM_SET_MK1:
-        case ROM_SET_SC155:
-            mcu_mk1 = true;
-            mcu_st = false;
-            if (romset == ROM_SET_SC155)
-                mcu_sc155 = true;
-            break;
-        case ROM_SET_CM300:
-            mcu_mk1 = true;
-            mcu_cm300 = true;
-            break;
-        case ROM_SET_JV880:
-            mcu_jv880 = true;
-            rom2_mask /= 2; // rom is half the size
-            lcd.lcd_width = 820;
-            lcd.lcd_height = 100;
-            lcd.lcd_col1 = 0x000000;
-            lcd.lcd_col2 = 0x78b500;
-            break;
-        case ROM_SET_SCB55:
-        case ROM_SET_RLP3237:
-            mcu_scb55 = true;
-            break;
+        rom2_mask /= 2; // rom is half the size
+        lcd.lcd_width = 820;
+        lcd.lcd_height = 100;
+        lcd.lcd_col1 = 0x000000;
+        lcd.lcd_col2 = 0x78b500;
     }
 
     memset(&mcu, 0, sizeof(mcu_t));
@@ -1245,7 +1414,8 @@ int MCU::startSC55(const char* s_rom1, const char* s_rom2, const char* s_waverom
 }
 
 void MCU::updateSC55WithSampleRate(float *dataL, float *dataR, unsigned int nFrames, int destSampleRate) {
-    double renderBufferFramesFloat = (double)nFrames / destSampleRate * 64000;
+    int srcSampleRate = MCU_GetSampleRate();
+    double renderBufferFramesFloat = (double)nFrames / destSampleRate * srcSampleRate;
     unsigned int renderBufferFrames = ceil(renderBufferFramesFloat);
     double currentError = renderBufferFrames - renderBufferFramesFloat;
 
@@ -1268,82 +1438,442 @@ void MCU::updateSC55WithSampleRate(float *dataL, float *dataR, unsigned int nFra
 
     sample_write_ptr = 0;
 
-    int maxCycles = nFrames * 256;
+    // twice the cycles of the slowest possible frame rate
+    uint64_t maxCycles = (renderBufferFrames / 2 + 1) * PCM_MAX_FRAME_CYCLES * 2;
+
+    if (engine_mode == MCU_ENGINE_SCHEDULED && (mcu_mk1 || mcu_jv880))
+        MCU_RunScheduled(renderBufferFrames, maxCycles);
+    else
+        MCU_RunPolling(renderBufferFrames, maxCycles);
+
+    pcm.PCM_PublishTelemetry(renderBufferFrames);
+
+    double ratio = (double)destSampleRate / srcSampleRate;
+    if (resampler && (int)renderBufferFrames > resampler->max_block) {
+        // a larger block than MCU_PrepareOutput was told about
+        output_max_block = audio_buffer_size;
+        savedDestSampleRate = 0;
+    }
+    if (savedDestSampleRate != destSampleRate || savedSrcSampleRate != srcSampleRate
+        || savedResamplerQuality != resampler_quality) {
+        savedDestSampleRate = destSampleRate;
+        savedSrcSampleRate = srcSampleRate;
+        savedResamplerQuality = resampler_quality;
+        MCU_SetupResampler(srcSampleRate, destSampleRate);
+    }
+
+    if (resampler) {
+        // both channels in one pass, straight from the PCM samples. Short
+        // of nFrames while the filter fills up, the rest is silence.
+        int out = resampler->RESAMPLER_Process(sample_buffer, renderBufferFrames, dataL, dataR, nFrames);
+        memset(dataL + out, 0, (nFrames - out) * sizeof(float));
+        memset(dataR + out, 0, (nFrames - out) * sizeof(float));
+        samplesError += currentError;
+    } else {
+        MCU_ConvertSamples(renderBufferFrames);
+
+        int inUsedL = 0;
+        int inUsedR = 0;
+        int outL = 0;
+        int outR = 0;
+
+        outL = resample_process(resampleL, ratio, sample_buffer_l, renderBufferFrames, false, &inUsedL, dataL, nFrames);
+        outR = resample_process(resampleR, ratio, sample_buffer_r, renderBufferFrames, false, &inUsedR, dataR, nFrames);
+        memset(dataL + std::max(outL, 0), 0, (nFrames - std::max(outL, 0)) * sizeof(float));
+        memset(dataR + std::max(outR, 0), 0, (nFrames - std::max(outR, 0)) * sizeof(float));
+
+        samplesError += currentError;
+        // printf("error: %f total: %f\n", currentError, samplesError);
+
+        if (inUsedL == 0 || inUsedR == 0) {
+            samplesError = 0;
+            printf("click: %d %d\n", outL, outR);
+        }
+    }
+
+    // printf("req %d to render %d rendered %d resampled %d %d output %d %d\n", nFrames, renderBufferFrames, sample_write_ptr, inUsedL, inUsedR, outL, outR);
+
+    // Flush the midi buffer
+    for (; midi_queue_read < midi_queue_count; midi_queue_read++)
+        postMidiSC55(midi_queue[midi_queue_read].data, midi_queue[midi_queue_read].length);
+    midi_queue_count = 0;
+    midi_queue_read = 0;
+
+    pcm.PCM_LatchOutput();
+}
+
+// Sample rate dependent setup of the output path for blocks of up to
+// maxBlockFrames at destSampleRate: resamplers for every quality at each
+// source rate the PCM can switch to, the libresample fallback for other
+// ratios, and the error accumulator. Allocates, so not on the audio
+// thread, which then only has to pick the prepared resampler.
+void MCU::MCU_PrepareOutput(int destSampleRate, int maxBlockFrames)
+{
+    pcm.PCM_LatchOutput();
+    int srcSampleRate = MCU_GetSampleRate();
+
+    // see updateSC55WithSampleRate, which adds up to half a block
+    int maxSrcSampleRate = pcm.output_mode == PCM_OUTPUT_SINGLE ? 32000 : 64000;
+    output_max_block = std::min<int>(audio_buffer_size,
+        (int)ceil((double)maxBlockFrames / destSampleRate * maxSrcSampleRate) + maxBlockFrames / 2 + 1);
+
+    for (int samples = 1; samples <= 2; samples++)
+    {
+        if (pcm.output_mode != PCM_OUTPUT_CONFIG && samples != pcm.PCM_GetFrameSamples())
+            continue;
+        for (int quality = 0; quality <= RESAMPLER_QUALITY_MASTERING; quality++)
+        {
+            MCU_Resampler &r = resamplers[samples - 1][quality];
+            if (r.src_rate != 32000 * samples || r.dst_rate != destSampleRate || r.max_block != output_max_block)
+                r.RESAMPLER_Open(32000 * samples, destSampleRate, output_max_block, quality);
+        }
+    }
+
+    MCU_SetupResampler(srcSampleRate, destSampleRate);
+    savedDestSampleRate = destSampleRate;
+    savedSrcSampleRate = srcSampleRate;
+    savedResamplerQuality = resampler_quality;
+    samplesError = 0;
+
+    output_allocations = 0;
+}
+
+// Selects the resampler for the rates and resampler_quality. Whatever
+// MCU_PrepareOutput didn't set up is set up here and counted in
+// output_allocations.
+void MCU::MCU_SetupResampler(int srcSampleRate, int destSampleRate)
+{
+    MCU_Resampler &r = resamplers[srcSampleRate > 32000][resampler_quality];
+    if (r.src_rate != srcSampleRate || r.dst_rate != destSampleRate || r.quality != resampler_quality
+        || r.max_block < output_max_block)
+    {
+        r.RESAMPLER_Open(srcSampleRate, destSampleRate, output_max_block, resampler_quality);
+        output_allocations++;
+    }
+    else
+        r.RESAMPLER_Reset();
+
+    resampler = r.phases ? &r : nullptr;
+    if (resampler)
+        return;
+
+    double ratio = (double)destSampleRate / srcSampleRate;
+    int highQuality = resampler_quality != RESAMPLER_QUALITY_DRAFT;
+    if (resampleL && resampleR && libresampleRatio == ratio && libresampleHighQuality == highQuality)
+        return;
+
+    if (resampleL) resample_close(resampleL);
+    if (resampleR) resample_close(resampleR);
+    resampleL = resample_open(highQuality, ratio, ratio);
+    resampleR = resample_open(highQuality, ratio, ratio);
+    libresampleRatio = ratio;
+    libresampleHighQuality = highQuality;
+    output_allocations++;
+}
+
+// Rate of the samples rendered by the PCM, and of MIDI event positions
+int MCU::MCU_GetSampleRate(void)
+{
+    return 32000 * pcm.PCM_GetFrameSamples();
+}
+
+void MCU::MCU_ProcessMidiQueue(void)
+{
+    while (midi_queue_read < midi_queue_count && midi_queue[midi_queue_read].samplePos <= sample_write_ptr) {
+        postMidiSC55(midi_queue[midi_queue_read].data, midi_queue[midi_queue_read].length);
+        midi_queue_read++;
+    }
+}
+
+void MCU::MCU_UpdatePeripherals(void)
+{
+    pcm.PCM_Update(mcu.cycles);
+
+    mcu_timer.TIMER_Clock(mcu.cycles);
+
+    if (!mcu_mk1 && !mcu_jv880)
+        sub_mcu.SM_Update(mcu.cycles);
+    else
+    {
+        MCU_UpdateUART_RX();
+        MCU_UpdateUART_TX();
+    }
 
-    for (int i = 0; sample_write_ptr < renderBufferFrames; i++) {
-        if (i > maxCycles) {
+    MCU_UpdateAnalog(mcu.cycles);
+}
+
+void MCU::MCU_RunPolling(unsigned int renderBufferFrames, uint64_t maxCycles)
+{
+    uint64_t end = mcu.cycles + maxCycles;
+
+    while (sample_write_ptr < renderBufferFrames) {
+        if (mcu.cycles > end) {
             printf("Not enough samples!\n");
             fflush(stdout);
             break;
         }
 
-       for (int i = 0; i < midiQueue.size(); i++) {
-           if (!midiQueue[i].processed && midiQueue[i].samplePos <= sample_write_ptr) {
-               postMidiSC55(midiQueue[i].data, midiQueue[i].length);
-               midiQueue[i].processed = true;
-           }
-       }
+        MCU_ProcessMidiQueue();
 
+        uint32_t states = 0;
         if (!mcu.ex_ignore)
-            MCU_Interrupt_Handle(this);
+            states = MCU_Interrupt_Handle(this);
         else
             mcu.ex_ignore = 0;
 
         if (!mcu.sleep)
-            MCU_ReadInstruction();
+            states += MCU_ReadInstruction();
+
+        mcu.cycles += MCU_StepCycles(states);
+
+        MCU_UpdatePeripherals();
+    }
+}
 
-        mcu.cycles += 12; // FIXME: assume 12 cycles per instruction
+// Earliest cycle count at which MCU_UpdatePeripherals can change anything
+// apart from the PCM and the FRT counters. Only valid until the next
+// MCU_ReadIO/MCU_WriteIO or peripheral update.
+uint64_t MCU::MCU_NextPeripheralDeadline(void)
+{
+    uint64_t deadline = mcu_timer.TIMER_NextEvent();
 
-        pcm.PCM_Update(mcu.cycles);
+    if ((dev_register[DEV_SCR] & 16) != 0 && uart_write_ptr != uart_read_ptr
+        && (dev_register[DEV_SSR] & 0x40) == 0 && uart_rx_delay < deadline)
+        deadline = uart_rx_delay;
 
-        mcu_timer.TIMER_Clock(mcu.cycles);
+    if ((dev_register[DEV_SCR] & 32) != 0 && (dev_register[DEV_SSR] & 0x80) == 0
+        && uart_tx_delay < deadline)
+        deadline = uart_tx_delay;
 
-        if (!mcu_mk1 && !mcu_jv880)
-            sub_mcu.SM_Update(mcu.cycles);
-        else
+    if (dev_register[DEV_ADCSR] & 0x20)
+    {
+        if (analog_end_time == 0)
+            deadline = 0;
+        else if (analog_end_time + 1 < deadline)
+            deadline = analog_end_time + 1;
+    }
+    else if (analog_end_time != 0)
+        deadline = 0;
+
+    return deadline;
+}
+
+// While the cpu sleeps, PCM frames that can't raise an interrupt (irq_assert
+// is still set) don't need a peripheral update of their own and can be
+// rendered by a single PCM_Update call, up to the frame that reaches the
+// next MIDI event or the end of the buffer.
+uint64_t MCU::MCU_NextSleepDeadline(uint64_t deadline, unsigned int renderBufferFrames)
+{
+    if (!pcm.pcm.irq_assert)
+        return std::min(deadline, pcm.pcm.cycles + 1);
+
+    int limit = renderBufferFrames;
+    if (midi_queue_read < midi_queue_count && midi_queue[midi_queue_read].samplePos < limit)
+        limit = midi_queue[midi_queue_read].samplePos;
+
+    int samples = pcm.PCM_GetFrameSamples();
+    uint64_t frames = limit > sample_write_ptr ? (limit - sample_write_ptr + samples - 1) / samples : 1;
+
+    return std::min(deadline, pcm.pcm.cycles + (frames - 1) * pcm.PCM_GetFrameCycles() + 1);
+}
+
+// Called after a taken short backward branch, i.e. at the head of a loop.
+// Returns the number of instructions per iteration once the loop is known
+// to be idle, 0 otherwise. An iteration is stationary when it starts and
+// ends in the same CPU state without writing memory and without a
+// peripheral event in between. Two stationary iterations that also read
+// the same values from I/O are exact replays: the only side effects left
+// are the (idempotent) ones of those reads, so every further iteration
+// does the same until the next peripheral event.
+uint32_t MCU::MCU_CheckIdleLoop(int i)
+{
+    mcu_loop_head_t head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.r, mcu.r, sizeof(head.r));
+    head.pc = mcu.pc;
+    head.sr = MCU_GetSR();
+    head.cp = mcu.cp;
+    head.dp = mcu.dp;
+    head.ep = mcu.ep;
+    head.tp = mcu.tp;
+    head.br = mcu.br;
+    head.ex_ignore = mcu.ex_ignore;
+
+    uint32_t instructions = 0;
+    if (!memcmp(&head, &loop_head, sizeof(head)) && i > loop_head_i
+        && write_count == loop_head_writes && peripheral_events == loop_head_events)
+    {
+        if (loop_stationary && io_read_hash == loop_trace)
         {
-            MCU_UpdateUART_RX();
-            MCU_UpdateUART_TX();
+            instructions = i - loop_head_i;
+            loop_cycles = mcu.cycles - loop_head_cycles;
         }
-
-        MCU_UpdateAnalog(mcu.cycles);
+        loop_stationary = 1;
     }
+    else
+        loop_stationary = 0;
 
-    double ratio = (double)destSampleRate / 64000;
-    if (savedDestSampleRate != destSampleRate) {
-        savedDestSampleRate = destSampleRate;
-        if (resampleL) resample_close(resampleL);
-        if (resampleR) resample_close(resampleR);
-        resampleL = resample_open(1, ratio, ratio);
-        resampleR = resample_open(1, ratio, ratio);
+    loop_head = head;
+    loop_head_cycles = mcu.cycles;
+    loop_head_i = i;
+    loop_head_writes = write_count;
+    loop_head_events = peripheral_events;
+    loop_trace = io_read_hash;
+    io_read_hash = 0;
+
+    return instructions;
+}
+
+void MCU::MCU_RecordIdleLoop(uint32_t instructions, uint64_t iterations)
+{
+    mcu_idle_loop_t *stats = nullptr;
+    for (int i = 0; i < idle_loop_count; i++)
+    {
+        if (idle_loop_stats[i].cp == mcu.cp && idle_loop_stats[i].pc == mcu.pc)
+        {
+            stats = &idle_loop_stats[i];
+            break;
+        }
     }
+    if (!stats)
+    {
+        if (idle_loop_count == IDLE_LOOP_STATS_SIZE)
+            return;
+        stats = &idle_loop_stats[idle_loop_count++];
+        memset(stats, 0, sizeof(*stats));
+        stats->cp = mcu.cp;
+        stats->pc = mcu.pc;
+    }
+    stats->instructions = instructions;
+    stats->loop_cycles = loop_cycles;
+    stats->skips++;
+    stats->iterations_skipped += iterations;
+    stats->cycles_skipped += iterations * loop_cycles;
+}
 
-    int inUsedL = 0;
-    int inUsedR = 0;
-    int outL = 0;
-    int outR = 0;
+// Copies the statistics of up to max loops, returns the number copied.
+// Not synchronized with the audio thread.
+int MCU::MCU_GetIdleLoopStats(mcu_idle_loop_t *stats, int max)
+{
+    int count = std::min(max, idle_loop_count);
+    memcpy(stats, idle_loop_stats, count * sizeof(mcu_idle_loop_t));
+    return count;
+}
 
-    outL = resample_process(resampleL, ratio, sample_buffer_l, renderBufferFrames, false, &inUsedL, dataL, nFrames);
-    outR = resample_process(resampleR, ratio, sample_buffer_r, renderBufferFrames, false, &inUsedR, dataR, nFrames);
+void MCU::MCU_ResetIdleLoopStats(void)
+{
+    idle_loop_count = 0;
+}
 
-    samplesError += currentError;
-    // printf("error: %f total: %f\n", currentError, samplesError);
+#ifdef MCU_PROFILER
+void MCU::MCU_EnableProfiler(bool enable)
+{
+    profiler.PROFILER_Enable(enable);
+}
 
-    if (inUsedL == 0 || inUsedR == 0) {
-        samplesError = 0;
-        printf("click: %d %d\n", outL, outR);
-    }
+void MCU::MCU_ResetProfiler(void)
+{
+    profiler.PROFILER_Reset();
+}
 
-    // printf("req %d to render %d rendered %d resampled %d %d output %d %d\n", nFrames, renderBufferFrames, sample_write_ptr, inUsedL, inUsedR, outL, outR);
+// Not synchronized with the audio thread
+void MCU::MCU_WriteProfile(FILE *file, int format, int max_addresses)
+{
+    profiler.PROFILER_Report(file, format, max_addresses);
+}
+#endif
 
-    // Flush the midi buffer
-    for (int i = 0; i < midiQueue.size(); i++) {
-        if (!midiQueue[i].processed) {
-            postMidiSC55(midiQueue[i].data, midiQueue[i].length);
-            midiQueue[i].processed = true;
+// Bit-exact with MCU_RunPolling: peripherals are only updated after an
+// instruction that reached a deadline or touched an I/O register, the
+// updates in between would have been no-ops.
+void MCU::MCU_RunScheduled(unsigned int renderBufferFrames, uint64_t maxCycles)
+{
+    uint64_t end = mcu.cycles + maxCycles;
+    int i = 0;
+
+    // anything may have happened since the last block
+    peripheral_events++;
+    idle_branch = 0;
+
+    MCU_ProcessMidiQueue();
+
+    while (sample_write_ptr < (int)renderBufferFrames) {
+        if (mcu.cycles > end) {
+            printf("Not enough samples!\n");
+            fflush(stdout);
+            break;
+        }
+
+        uint64_t peripheral_deadline = MCU_NextPeripheralDeadline();
+        uint64_t deadline = std::min(peripheral_deadline, pcm.pcm.cycles + 1);
+        uint64_t last_cycles;
+
+        io_access = 0;
+        for (;;) {
+            last_cycles = mcu.cycles;
+
+            uint32_t states = 0;
+            int handled = !mcu.ex_ignore;
+            if (handled)
+                states = MCU_Interrupt_Handle(this);
+            else
+                mcu.ex_ignore = 0;
+
+            if (!mcu.sleep)
+                states += MCU_ReadInstruction();
+            else if (handled)
+            {
+                // No interrupt was taken, so every iteration until the next
+                // peripheral update does the same: nothing. Skip to the last one.
+                uint64_t sleep_deadline = MCU_NextSleepDeadline(peripheral_deadline, renderBufferFrames);
+                uint64_t n = 1;
+                if (sleep_deadline > mcu.cycles + 12)
+                    n = (sleep_deadline - mcu.cycles + 11) / 12;
+                n = std::min<uint64_t>(n, (end - mcu.cycles) / 12 + 1);
+                deadline = sleep_deadline;
+                mcu.cycles += (n - 1) * 12;
+                last_cycles = mcu.cycles;
+            }
+
+            mcu.cycles += MCU_StepCycles(states);
+
+            i++;
+
+            if (idle_branch)
+            {
+                idle_branch = 0;
+                uint32_t instructions = MCU_CheckIdleLoop(i);
+                if (instructions && mcu.cycles < deadline)
+                {
+                    // Skip whole iterations as long as every peripheral
+                    // update they contain would have been a no-op.
+                    uint64_t n = (deadline - mcu.cycles - 1) / loop_cycles;
+                    n = std::min<uint64_t>(n, (end - mcu.cycles) / loop_cycles);
+                    if (n)
+                    {
+                        MCU_RecordIdleLoop(instructions, n);
+                        mcu.cycles += n * loop_cycles;
+                        last_cycles += n * loop_cycles;
+                        i += n * instructions;
+                        loop_head_cycles = mcu.cycles;
+                        loop_head_i = i;
+                    }
+                }
+            }
+
+            if (io_access || mcu.cycles >= deadline || mcu.cycles > end)
+                break;
         }
+
+        if (!io_access || mcu.cycles >= deadline)
+            peripheral_events++;
+
+        mcu_timer.TIMER_Advance(last_cycles);
+
+        MCU_UpdatePeripherals();
+
+        MCU_ProcessMidiQueue();
     }
-    midiQueue.clear();
 }
 
 void MCU::SC55_Reset() {
@@ -1373,6 +1903,7 @@ void MCU::SC55_Reset() {
     lcd.LCD_Init();
     MCU_Init();
     MCU_PatchROM();
+    MCU_InvalidateDecodeCache();
     MCU_Reset();
     sub_mcu.SM_Reset();
     pcm.PCM_Reset();
@@ -1387,10 +1918,21 @@ void MCU::postMidiSC55(const uint8_t* message, int length) {
     }
 }
 
-void MCU::enqueueMidiSC55(const uint8_t* message, int length, int samplePos) {
-    MidiEvent event = {0};
+// Returns false if the event doesn't fit, the queue is never grown
+bool MCU::enqueueMidiSC55(const uint8_t* message, int length, int samplePos) {
+    if (midi_queue_count == MIDI_QUEUE_SIZE || length > (int)sizeof(midi_queue[0].data)) {
+        midi_dropped++;
+        return false;
+    }
+
+    // usually in order already, else behind the events at the same position
+    int i = midi_queue_count++;
+    for (; i > midi_queue_read && midi_queue[i - 1].samplePos > samplePos; i--)
+        midi_queue[i] = midi_queue[i - 1];
+
+    MidiEvent &event = midi_queue[i];
     event.length = length;
     event.samplePos = samplePos;
-    memcpy(&event.data, message, length);
-    midiQueue.push_back(event);
+    memcpy(event.data, message, length);
+    return true;
 }
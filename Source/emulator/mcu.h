@@ -34,12 +34,14 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
 #include "mcu_interrupt.h"
 #include "pcm.h"
+#include "mcu_resampler.h"
+#include "mcu_renderahead.h"
 #include "lcd.h"
 #include "mcu_timer.h"
 #include "submcu.h"
+#include "mcu_profiler.h"
 
 #ifdef __APPLE__
 #include <sys/syslimits.h> // PATH_MAX
@@ -121,6 +123,14 @@ enum {
     STATUS_INT_MASK = 0x700
 };
 
+// Pending evaluation of N, Z, V and C, see MCU_GetSR
+enum {
+    STATUS_OP_NONE = 0, // sr is up to date
+    STATUS_OP_ADD,
+    STATUS_OP_SUB,
+    STATUS_OP_LOGIC // N and Z from the result, V cleared, C unchanged
+};
+
 enum {
     VECTOR_RESET = 0,
     VECTOR_RESERVED1, // UNUSED
@@ -190,11 +200,53 @@ struct mcu_t {
     uint8_t sleep;
     uint8_t ex_ignore;
     int32_t exception_pending;
-    uint8_t interrupt_pending[INTERRUPT_SOURCE_MAX];
-    uint8_t trapa_pending[16];
+    uint32_t interrupt_pending; // bit per INTERRUPT_SOURCE_*
+    uint16_t trapa_pending; // bit per TRAPA vector
+    uint8_t interrupt_level; // see MCU_Interrupt_UpdatePriority
+    uint8_t status_op; // STATUS_OP_* of the last ALU operation
+    uint8_t status_siz;
+    uint8_t status_c_bit;
+    uint32_t status_t1; // operands, or the result for STATUS_OP_LOGIC
+    uint32_t status_t2;
     uint64_t cycles;
 };
 
+// Pre-decoded instruction, cached for code fetched from ROM
+struct mcu_decode_t {
+    uint32_t tag; // (cp << 16) | pc
+    uint16_t disp; // displacement, absolute address or immediate data
+    uint8_t operand;
+    uint8_t length; // bytes consumed before the handler is called
+    uint8_t general;
+    uint8_t type;
+    uint8_t mode; // increase mode, or page source for absolute addressing
+    uint8_t reg;
+    uint8_t siz;
+    uint8_t opcode;
+    uint8_t opcode_reg;
+    uint8_t opcode_extended;
+};
+
+// CPU state at the head of a polling loop, see MCU_CheckIdleLoop
+struct mcu_loop_head_t {
+    uint16_t r[8];
+    uint16_t pc;
+    uint16_t sr;
+    uint8_t cp, dp, ep, tp, br;
+    uint8_t ex_ignore;
+};
+
+// Per-loop statistics of the idle loop detector
+struct mcu_idle_loop_t {
+    uint8_t cp;
+    uint16_t pc; // loop head
+    uint32_t instructions; // per iteration
+    uint64_t loop_cycles; // per iteration
+    uint64_t skips;
+    uint64_t iterations_skipped;
+    uint64_t cycles_skipped;
+};
+
 enum {
     // SC55
     MCU_BUTTON_POWER = 0,
@@ -265,6 +317,61 @@ enum {
     ROM_SET_COUNT
 };
 
+// Hardware differences between the romsets
+struct mcu_romset_traits_t {
+    int mk1; // 0 - SC-55mkII, SC-55ST. 1 - SC-55, CM-300/SCC-1
+    int cm300; // 0 - SC-55, 1 - CM-300/SCC-1
+    int st; // 0 - SC-55mk2, 1 - SC-55ST
+    int jv880; // 0 - SC-55, 1 - JV880
+    int scb55; // 0 - sub mcu (e.g SC-55mk2), 1 - no sub mcu (e.g SCB-55)
+    int sc155; // 0 - SC-55(MK2), 1 - SC-155(MK2)
+};
+
+constexpr mcu_romset_traits_t MCU_GetRomsetTraits(int romset)
+{
+    mcu_romset_traits_t traits = {};
+    switch (romset)
+    {
+        case ROM_SET_MK2:
+            break;
+        case ROM_SET_SC155MK2:
+            traits.sc155 = 1;
+            break;
+        case ROM_SET_ST:
+            traits.st = 1;
+            break;
+        case ROM_SET_MK1:
+            traits.mk1 = 1;
+            break;
+        case ROM_SET_SC155:
+            traits.mk1 = 1;
+            traits.sc155 = 1;
+            break;
+        case ROM_SET_CM300:
+            traits.mk1 = 1;
+            traits.cm300 = 1;
+            break;
+        case ROM_SET_JV880:
+            traits.jv880 = 1;
+            break;
+        case ROM_SET_SCB55:
+        case ROM_SET_RLP3237:
+            traits.scb55 = 1;
+            break;
+    }
+    return traits;
+}
+
+enum {
+    MCU_ENGINE_POLLING = 0, // poll every peripheral after each instruction
+    MCU_ENGINE_SCHEDULED, // run the cpu until the next peripheral deadline
+};
+
+enum {
+    MCU_TIMING_TABLE = 0, // per instruction states from the opcode handlers
+    MCU_TIMING_FIXED, // 12 cycles per instruction
+};
+
 enum class ResetType {
     NONE,
     GS_RESET,
@@ -285,18 +392,41 @@ const uint32_t uart_buffer_size = 8192;
 
 static const int audio_buffer_size = 4096 * 8;
 static const int audio_page_size = 512;
+static const int MIDI_QUEUE_SIZE = 1024; // events per block
 
 static const int ROM_SET_N_FILES = 6;
 
+static const int MEMORY_MAP_SHIFT = 7;
+static const int MEMORY_MAP_SIZE = 0x100000 >> MEMORY_MAP_SHIFT;
+static const uint32_t MEMORY_MAP_MASK = (1 << MEMORY_MAP_SHIFT) - 1;
+
+static const int DECODE_CACHE_SIZE = 8192;
+static const uint32_t DECODE_TAG_INVALID = 0xffffffff;
+
+static const int IDLE_LOOP_MAX_SIZE = 32; // bytes, longest backward branch considered a loop
+static const int IDLE_LOOP_STATS_SIZE = 32;
+
 struct MCU {
+#ifdef MCU_ROMSET
+    // romset fixed at compile time, branches for the others are compiled out
+    static constexpr int romset = MCU_ROMSET;
+
+    static constexpr int mcu_mk1 = MCU_GetRomsetTraits(MCU_ROMSET).mk1;
+    static constexpr int mcu_cm300 = MCU_GetRomsetTraits(MCU_ROMSET).cm300;
+    static constexpr int mcu_st = MCU_GetRomsetTraits(MCU_ROMSET).st;
+    static constexpr int mcu_jv880 = MCU_GetRomsetTraits(MCU_ROMSET).jv880;
+    static constexpr int mcu_scb55 = MCU_GetRomsetTraits(MCU_ROMSET).scb55;
+    static constexpr int mcu_sc155 = MCU_GetRomsetTraits(MCU_ROMSET).sc155;
+#else
     int romset = 0;
 
-    int mcu_mk1 = 0; // 0 - SC-55mkII, SC-55ST. 1 - SC-55, CM-300/SCC-1
-    int mcu_cm300 = 0; // 0 - SC-55, 1 - CM-300/SCC-1
-    int mcu_st = 0; // 0 - SC-55mk2, 1 - SC-55ST
-    int mcu_jv880 = 0; // 0 - SC-55, 1 - JV880
-    int mcu_scb55 = 0; // 0 - sub mcu (e.g SC-55mk2), 1 - no sub mcu (e.g SCB-55)
-    int mcu_sc155 = 0; // 0 - SC-55(MK2), 1 - SC-155(MK2)
+    int mcu_mk1 = 0;
+    int mcu_cm300 = 0;
+    int mcu_st = 0;
+    int mcu_jv880 = 0;
+    int mcu_scb55 = 0;
+    int mcu_sc155 = 0;
+#endif
 
     uint32_t mcu_button_pressed;
 
@@ -314,6 +444,34 @@ struct MCU {
 
     int rom2_mask = ROM2_SIZE - 1;
 
+    int engine_mode = MCU_ENGINE_POLLING;
+    int instruction_timing = MCU_TIMING_TABLE;
+    int io_access = 0; // set by every MCU_ReadIO/MCU_WriteIO
+
+    // idle loop detection, scheduled engine only
+    int idle_branch = 0; // set by a taken short backward Bcc
+    uint32_t write_count = 0; // incremented by every MCU_Write
+    uint32_t io_read_hash = 0; // addresses and values returned by MCU_ReadIO
+    uint32_t peripheral_events = 0; // peripheral updates that may change an I/O read
+    mcu_loop_head_t loop_head = {0};
+    uint64_t loop_head_cycles = 0;
+    int loop_head_i = 0;
+    uint32_t loop_head_writes = 0;
+    uint32_t loop_head_events = 0;
+    uint32_t loop_trace = 0;
+    int loop_stationary = 0;
+    uint64_t loop_cycles = 0;
+    mcu_idle_loop_t idle_loop_stats[IDLE_LOOP_STATS_SIZE];
+    int idle_loop_count = 0;
+
+    // host pointers for every 128 byte block of the 1 MB address space,
+    // nullptr means the block is handled by MCU_ReadIO/MCU_WriteIO, as all
+    // of them are until the first MCU_UpdateMemoryMap (the reset vector is
+    // read before)
+    uint8_t *read_map[MEMORY_MAP_SIZE] = {};
+    uint8_t *write_map[MEMORY_MAP_SIZE] = {};
+
+    int32_t sample_buffer[audio_buffer_size][2] = {0}; // written by the PCM
     float sample_buffer_l[audio_buffer_size] = {0};
     float sample_buffer_r[audio_buffer_size] = {0};
     int sample_write_ptr = 0;
@@ -354,6 +512,8 @@ struct MCU {
     uint16_t operand_data;
     uint8_t opcode_extended;
 
+    mcu_decode_t decode_cache[DECODE_CACHE_SIZE];
+
     FILE *s_rf[ROM_SET_N_FILES] =
     {
         nullptr,
@@ -367,21 +527,39 @@ struct MCU {
     LCD lcd;
     MCU_Timer mcu_timer;
     SubMcu sub_mcu;
+#ifdef MCU_PROFILER
+    MCU_Profiler profiler;
+#endif
 
-    void* resampleL = 0;
+    MCU_Resampler resamplers[2][3]; // [32 kHz, 64 kHz][RESAMPLER_QUALITY_*]
+    MCU_Resampler *resampler = nullptr; // the one in use, nullptr for libresample
+    int resampler_quality = RESAMPLER_QUALITY_NORMAL;
+    int output_max_block = audio_buffer_size; // most source samples a block renders
+    uint32_t output_allocations = 0; // output setups that allocated, see MCU_PrepareOutput
+    void* resampleL = 0; // libresample, for ratios the resampler has no table for
     void* resampleR = 0;
+    double libresampleRatio = 0;
+    int libresampleHighQuality = -1;
     int savedDestSampleRate = 0;
+    int savedSrcSampleRate = 0;
+    int savedResamplerQuality = RESAMPLER_QUALITY_NORMAL;
     double samplesError = 0;
     
     struct MidiEvent {
         uint8_t data[32];
         int length;
         int samplePos;
-        bool processed;
     };
-    std::vector<MidiEvent> midiQueue;
+    // sorted by samplePos, the ones before midi_queue_read are posted
+    MidiEvent midi_queue[MIDI_QUEUE_SIZE];
+    int midi_queue_count = 0;
+    int midi_queue_read = 0;
+    uint32_t midi_dropped = 0; // queue full or message too long
+
+    MCU_RenderAhead render_ahead;
 
     MCU();
+    ~MCU();
 
     void MCU_ErrorTrap(void);
 
@@ -390,6 +568,9 @@ struct MCU {
     uint32_t MCU_Read32(uint32_t address);
     void MCU_Write(uint32_t address, uint8_t value);
     void MCU_Write16(uint32_t address, uint16_t value);
+    uint8_t MCU_ReadIO(uint32_t address);
+    void MCU_WriteIO(uint32_t address, uint8_t value);
+    void MCU_UpdateMemoryMap(void);
 
     uint8_t MCU_ReadP0(void);
     uint8_t MCU_ReadP1(void);
@@ -399,14 +580,32 @@ struct MCU {
     void MCU_UpdateUART_RX(void);
     void MCU_UpdateUART_TX(void);
 
-    void MCU_PostSample(int *sample);
+    void MCU_ConvertSamples(int count);
     void MCU_PostUART(uint8_t data);
     void MCU_EncoderTrigger(int dir);
 
     int startSC55(const char* s_rom1, const char* s_rom2, const char* s_waverom1, const char* s_waverom2, const char* s_nvram);
     void updateSC55WithSampleRate(float *dataL, float *dataR, unsigned int nFrames, int destSampleRate);
+    void MCU_RunPolling(unsigned int renderBufferFrames, uint64_t maxCycles);
+    void MCU_RunScheduled(unsigned int renderBufferFrames, uint64_t maxCycles);
+    void MCU_UpdatePeripherals(void);
+    uint64_t MCU_NextPeripheralDeadline(void);
+    uint64_t MCU_NextSleepDeadline(uint64_t deadline, unsigned int renderBufferFrames);
+    int MCU_GetSampleRate(void);
+    void MCU_PrepareOutput(int destSampleRate, int maxBlockFrames);
+    void MCU_SetupResampler(int srcSampleRate, int destSampleRate);
+    void MCU_ProcessMidiQueue(void);
+    uint32_t MCU_CheckIdleLoop(int i);
+    void MCU_RecordIdleLoop(uint32_t instructions, uint64_t iterations);
+    int MCU_GetIdleLoopStats(mcu_idle_loop_t *stats, int max);
+    void MCU_ResetIdleLoopStats(void);
+#ifdef MCU_PROFILER
+    void MCU_EnableProfiler(bool enable);
+    void MCU_ResetProfiler(void);
+    void MCU_WriteProfile(FILE *file, int format, int max_addresses);
+#endif
     void postMidiSC55(const uint8_t* message, int length);
-    void enqueueMidiSC55(const uint8_t* message, int length, int samplePos);
+    bool enqueueMidiSC55(const uint8_t* message, int length, int samplePos);
     void SC55_Reset();
 
     uint8_t RCU_Read(void);
@@ -416,10 +615,21 @@ struct MCU {
     uint8_t MCU_DeviceRead(uint32_t address);
     void MCU_DeviceReset(void);
     void MCU_UpdateAnalog(uint64_t cycles);
-    void MCU_ReadInstruction(void);
+    uint32_t MCU_ReadInstruction(void);
+
+    // Cycles taken by a step of the run loop, given the states of the
+    // exception handling and instruction it executed. A sleeping cpu
+    // advances in steps of 12 cycles, as does every step with fixed timing.
+    uint32_t MCU_StepCycles(uint32_t states)
+    {
+        if (instruction_timing == MCU_TIMING_FIXED || states == 0)
+            return 12;
+        return states * 2;
+    }
     void MCU_Init(void);
     void MCU_Reset(void);
     void MCU_PatchROM(void);
+    void MCU_InvalidateDecodeCache(void);
 
     uint32_t MCU_GetAddress(uint8_t page, uint16_t address);
     uint8_t MCU_ReadCode(void);
@@ -430,6 +640,36 @@ struct MCU {
     void MCU_ControlRegisterWrite(uint32_t reg, uint32_t siz, uint32_t data);
     uint32_t MCU_ControlRegisterRead(uint32_t reg, uint32_t siz);
     void MCU_SetStatus(uint32_t condition, uint32_t mask);
+    void MCU_EvaluateStatus(void);
+
+    // The ALU helpers only record their operands, the condition codes are
+    // written to sr when something reads them
+    uint16_t MCU_GetSR(void)
+    {
+        if (mcu.status_op != STATUS_OP_NONE)
+            MCU_EvaluateStatus();
+        return mcu.sr;
+    }
     void MCU_PushStack(uint16_t data);
     uint16_t MCU_PopStack(void);
 };
+
+inline uint8_t MCU::MCU_Read(uint32_t address)
+{
+    const uint8_t *block = read_map[(address >> MEMORY_MAP_SHIFT) & (MEMORY_MAP_SIZE - 1)];
+    if (block)
+        return block[address & MEMORY_MAP_MASK];
+    uint8_t ret = MCU_ReadIO(address);
+    io_read_hash = (io_read_hash ^ (address << 8) ^ ret) * 0x01000193;
+    return ret;
+}
+
+inline void MCU::MCU_Write(uint32_t address, uint8_t value)
+{
+    uint8_t *block = write_map[(address >> MEMORY_MAP_SHIFT) & (MEMORY_MAP_SIZE - 1)];
+    write_count++;
+    if (block)
+        block[address & MEMORY_MAP_MASK] = value;
+    else
+        MCU_WriteIO(address, value);
+}
@@ -39,7 +39,7 @@ void MCU_Interrupt_Start(MCU* mcu, int32_t mask)
 {
     mcu->MCU_PushStack(mcu->mcu.pc);
     mcu->MCU_PushStack(mcu->mcu.cp);
-    mcu->MCU_PushStack(mcu->mcu.sr);
+    mcu->MCU_PushStack(mcu->MCU_GetSR());
     mcu->mcu.sr &= ~STATUS_T;
     if (mask >= 0)
     {
@@ -49,9 +49,85 @@ void MCU_Interrupt_Start(MCU* mcu, int32_t mask)
     mcu->mcu.sleep = 0;
 }
 
+// Vector and priority register field of each interrupt source
+static const struct {
+    int32_t vector;
+    uint8_t ipr;
+    uint8_t shift;
+} interrupt_sources[INTERRUPT_SOURCE_MAX] = {
+    { VECTOR_NMI, 0, 0 },
+    { VECTOR_IRQ0, DEV_IPRA, 4 },
+    { VECTOR_IRQ1, DEV_IPRA, 0 },
+    { -1, 0, 0 }, // FRT0_ICI
+    { VECTOR_INTERNAL_INTERRUPT_94, DEV_IPRB, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_98, DEV_IPRB, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_9C, DEV_IPRB, 4 },
+    { -1, 0, 0 }, // FRT1_ICI
+    { VECTOR_INTERNAL_INTERRUPT_A4, DEV_IPRB, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_A8, DEV_IPRB, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_AC, DEV_IPRB, 0 },
+    { -1, 0, 0 }, // FRT2_ICI
+    { VECTOR_INTERNAL_INTERRUPT_B4, DEV_IPRC, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_B8, DEV_IPRC, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_BC, DEV_IPRC, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_C0, DEV_IPRC, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_C4, DEV_IPRC, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_C8, DEV_IPRC, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_E0, DEV_IPRD, 0 },
+    { VECTOR_INTERNAL_INTERRUPT_D4, DEV_IPRD, 4 },
+    { VECTOR_INTERNAL_INTERRUPT_D8, DEV_IPRD, 4 },
+};
+
+// Priority of a maskable source, 0 if it can't be taken
+static uint32_t MCU_Interrupt_GetLevel(MCU* mcu, uint32_t interrupt)
+{
+    if (interrupt == INTERRUPT_SOURCE_IRQ0 && (mcu->dev_register[DEV_P1CR] & 0x20) == 0)
+        return 0;
+    if (interrupt == INTERRUPT_SOURCE_IRQ1 && (mcu->dev_register[DEV_P1CR] & 0x40) == 0)
+        return 0;
+    if (interrupt_sources[interrupt].vector < 0)
+        return 0;
+    return (mcu->dev_register[interrupt_sources[interrupt].ipr] >> interrupt_sources[interrupt].shift) & 7;
+}
+
+// Recomputes the cached interrupt_level, the highest priority among the
+// pending requests or 8 if an exception is pending. Needs to be called
+// whenever a request, IPRA-IPRD or P1CR changes.
+void MCU_Interrupt_UpdatePriority(MCU* mcu)
+{
+    uint32_t level = 0;
+    if (mcu->mcu.trapa_pending || mcu->mcu.exception_pending >= 0
+        || (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_NMI)))
+    {
+        level = 8;
+    }
+    else
+    {
+        uint32_t pending = mcu->mcu.interrupt_pending;
+        for (uint32_t i = 0; pending; i++, pending >>= 1)
+        {
+            if (pending & 1)
+            {
+                uint32_t l = MCU_Interrupt_GetLevel(mcu, i);
+                if (l > level)
+                    level = l;
+            }
+        }
+    }
+    mcu->mcu.interrupt_level = level;
+}
+
 void MCU_Interrupt_SetRequest(MCU* mcu, uint32_t interrupt, uint32_t value)
 {
-    mcu->mcu.interrupt_pending[interrupt] = value;
+    uint32_t pending = mcu->mcu.interrupt_pending;
+    if (value)
+        pending |= 1 << interrupt;
+    else
+        pending &= ~(1 << interrupt);
+    if (pending == mcu->mcu.interrupt_pending)
+        return;
+    mcu->mcu.interrupt_pending = pending;
+    MCU_Interrupt_UpdatePriority(mcu);
 }
 
 void MCU_Interrupt_Exception(MCU* mcu, uint32_t exception)
@@ -63,164 +139,93 @@ void MCU_Interrupt_Exception(MCU* mcu, uint32_t exception)
         return;
 #endif
     mcu->mcu.exception_pending = exception;
+    MCU_Interrupt_UpdatePriority(mcu);
 }
 
 void MCU_Interrupt_TRAPA(MCU* mcu, uint32_t vector)
 {
-    mcu->mcu.trapa_pending[vector] = 1;
+    mcu->mcu.trapa_pending |= 1 << vector;
+    MCU_Interrupt_UpdatePriority(mcu);
 }
 
-void MCU_Interrupt_StartVector(MCU* mcu, uint32_t vector, int32_t mask)
+// Returns the states taken by the exception handling sequence
+uint32_t MCU_Interrupt_StartVector(MCU* mcu, uint32_t vector, int32_t mask)
 {
     uint32_t address = mcu->MCU_GetVectorAddress(vector);
+#ifdef MCU_PROFILER
+    if (mcu->profiler.enabled)
+        mcu->profiler.PROFILER_EnterVector(vector);
+#endif
     MCU_Interrupt_Start(mcu, mask);
     mcu->mcu.cp = address >> 16;
     mcu->mcu.pc = address;
+    return 22; // stack pushes and vector fetch in maximum mode
 }
 
-void MCU_Interrupt_Handle(MCU* mcu)
+// Returns the states spent starting an exception, 0 if none was taken
+uint32_t MCU_Interrupt_Handle(MCU* mcu)
 {
 #if 0
     if (mcu->mcu.cycles % 2000 == 0 && mcu->mcu.sleep)
     {
-        MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_94);
-        return;
+        return MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_94);
     }
     if (mcu->mcu.cycles % 2000 == 1000 && mcu->mcu.sleep)
     {
-        MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_A4);
-        return;
+        return MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_A4);
     }
     if (mcu->mcu.cycles % 2000 == 1500 && mcu->mcu.sleep)
     {
-        MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_B4);
-        return;
+        return MCU_Interrupt_StartVector(mcu, VECTOR_INTERNAL_INTERRUPT_B4);
     }
 #endif
+    uint32_t mask = (mcu->mcu.sr >> 8) & 7;
+    if (mcu->mcu.interrupt_level <= mask)
+        return 0;
+
     uint32_t i;
-    for (i = 0; i < 16; i++)
+    if (mcu->mcu.trapa_pending)
     {
-        if (mcu->mcu.trapa_pending[i])
-        {
-            mcu->mcu.trapa_pending[i] = 0;
-            MCU_Interrupt_StartVector(mcu, VECTOR_TRAPA_0 + i, -1);
-            return;
-        }
+        for (i = 0; !(mcu->mcu.trapa_pending & (1 << i)); i++)
+            ;
+        mcu->mcu.trapa_pending &= ~(1 << i);
+        MCU_Interrupt_UpdatePriority(mcu);
+        return MCU_Interrupt_StartVector(mcu, VECTOR_TRAPA_0 + i, -1);
     }
     if (mcu->mcu.exception_pending >= 0)
     {
+        uint32_t states = 0;
         switch (mcu->mcu.exception_pending)
         {
             case EXCEPTION_SOURCE_ADDRESS_ERROR:
-                MCU_Interrupt_StartVector(mcu, VECTOR_ADDRESS_ERROR, -1);
+                states = MCU_Interrupt_StartVector(mcu, VECTOR_ADDRESS_ERROR, -1);
                 break;
             case EXCEPTION_SOURCE_INVALID_INSTRUCTION:
-                MCU_Interrupt_StartVector(mcu, VECTOR_INVALID_INSTRUCTION, -1);
+                states = MCU_Interrupt_StartVector(mcu, VECTOR_INVALID_INSTRUCTION, -1);
                 break;
             case EXCEPTION_SOURCE_TRACE:
-                MCU_Interrupt_StartVector(mcu, VECTOR_TRACE, -1);
+                states = MCU_Interrupt_StartVector(mcu, VECTOR_TRACE, -1);
                 break;
 
         }
         mcu->mcu.exception_pending = -1;
-        return;
+        MCU_Interrupt_UpdatePriority(mcu);
+        return states;
     }
-    if (mcu->mcu.interrupt_pending[INTERRUPT_SOURCE_NMI])
+    if (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_NMI))
     {
-        // mcu->mcu.interrupt_pending[INTERRUPT_SOURCE_NMI] = 0;
-        MCU_Interrupt_StartVector(mcu, VECTOR_NMI, 7);
-        return;
+        // mcu->mcu.interrupt_pending &= ~(1 << INTERRUPT_SOURCE_NMI);
+        return MCU_Interrupt_StartVector(mcu, VECTOR_NMI, 7);
     }
-    uint32_t mask = (mcu->mcu.sr >> 8) & 7;
-    for (i = INTERRUPT_SOURCE_NMI + 1; i < INTERRUPT_SOURCE_MAX; i++)
+    // sources are taken in order, not by priority
+    uint32_t pending = mcu->mcu.interrupt_pending >> (INTERRUPT_SOURCE_NMI + 1);
+    for (i = INTERRUPT_SOURCE_NMI + 1; pending; i++, pending >>= 1)
     {
-        int32_t vector = -1;
-        int32_t level = 0;
-        if (!mcu->mcu.interrupt_pending[i])
+        if (!(pending & 1))
             continue;
-        switch (i)
-        {
-            case INTERRUPT_SOURCE_IRQ0:
-                if ((mcu->dev_register[DEV_P1CR] & 0x20) == 0)
-                    continue;
-                vector = VECTOR_IRQ0;
-                level = (mcu->dev_register[DEV_IPRA] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_IRQ1:
-                if ((mcu->dev_register[DEV_P1CR] & 0x40) == 0)
-                    continue;
-                vector = VECTOR_IRQ1;
-                level = (mcu->dev_register[DEV_IPRA] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT0_OCIA:
-                vector = VECTOR_INTERNAL_INTERRUPT_94;
-                level = (mcu->dev_register[DEV_IPRB] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT0_OCIB:
-                vector = VECTOR_INTERNAL_INTERRUPT_98;
-                level = (mcu->dev_register[DEV_IPRB] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT0_FOVI:
-                vector = VECTOR_INTERNAL_INTERRUPT_9C;
-                level = (mcu->dev_register[DEV_IPRB] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT1_OCIA:
-                vector = VECTOR_INTERNAL_INTERRUPT_A4;
-                level = (mcu->dev_register[DEV_IPRB] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT1_OCIB:
-                vector = VECTOR_INTERNAL_INTERRUPT_A8;
-                level = (mcu->dev_register[DEV_IPRB] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT1_FOVI:
-                vector = VECTOR_INTERNAL_INTERRUPT_AC;
-                level = (mcu->dev_register[DEV_IPRB] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT2_OCIA:
-                vector = VECTOR_INTERNAL_INTERRUPT_B4;
-                level = (mcu->dev_register[DEV_IPRC] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT2_OCIB:
-                vector = VECTOR_INTERNAL_INTERRUPT_B8;
-                level = (mcu->dev_register[DEV_IPRC] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_FRT2_FOVI:
-                vector = VECTOR_INTERNAL_INTERRUPT_BC;
-                level = (mcu->dev_register[DEV_IPRC] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_TIMER_CMIA:
-                vector = VECTOR_INTERNAL_INTERRUPT_C0;
-                level = (mcu->dev_register[DEV_IPRC] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_TIMER_CMIB:
-                vector = VECTOR_INTERNAL_INTERRUPT_C4;
-                level = (mcu->dev_register[DEV_IPRC] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_TIMER_OVI:
-                vector = VECTOR_INTERNAL_INTERRUPT_C8;
-                level = (mcu->dev_register[DEV_IPRC] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_ANALOG:
-                vector = VECTOR_INTERNAL_INTERRUPT_E0;
-                level = (mcu->dev_register[DEV_IPRD] >> 0) & 7;
-                break;
-            case INTERRUPT_SOURCE_UART_RX:
-                vector = VECTOR_INTERNAL_INTERRUPT_D4;
-                level = (mcu->dev_register[DEV_IPRD] >> 4) & 7;
-                break;
-            case INTERRUPT_SOURCE_UART_TX:
-                vector = VECTOR_INTERNAL_INTERRUPT_D8;
-                level = (mcu->dev_register[DEV_IPRD] >> 4) & 7;
-                break;
-            default:
-                break;
-        }
-
-        if ((int32_t)mask < level)
-        {
-            // mcu->mcu.interrupt_pending[INTERRUPT_SOURCE_NMI] = 0;
-            MCU_Interrupt_StartVector(mcu, vector, level);
-            return;
-        }
+        uint32_t level = MCU_Interrupt_GetLevel(mcu, i);
+        if (mask < level)
+            return MCU_Interrupt_StartVector(mcu, interrupt_sources[i].vector, level);
     }
+    return 0;
 }
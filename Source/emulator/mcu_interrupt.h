@@ -40,7 +40,8 @@ struct MCU;
 void MCU_Interrupt_SetRequest(MCU* mcu, uint32_t interrupt, uint32_t value);
 void MCU_Interrupt_Exception(MCU* mcu, uint32_t exception);
 void MCU_Interrupt_TRAPA(MCU* mcu, uint32_t vector);
-void MCU_Interrupt_Handle(MCU* mcu);
+uint32_t MCU_Interrupt_Handle(MCU* mcu);
+void MCU_Interrupt_UpdatePriority(MCU* mcu);
 
 enum {
     INTERRUPT_SOURCE_NMI = 0,
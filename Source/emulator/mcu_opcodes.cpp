@@ -38,116 +38,43 @@
 
 int32_t MCU_SUB_Common(MCU *mcu, int32_t t1, int32_t t2, int32_t c_bit, uint32_t siz)
 {
-    int32_t st1, st2;
-    int32_t N, Z, C, V = 0;
-    if (siz)
-    {
-        st1 = (int16_t)t1;
-        st2 = (int16_t)t2;
-        t1 = (uint16_t)t1;
-        t2 = (uint16_t)t2;
-        t1 -= t2;
-        t1 -= c_bit;
-        C = (t1 >> 16) & 1;
-
-        t1 &= 0xffff;
-        N = (t1 & 0x8000) != 0;
-        Z = t1 == 0;
-
-        st1 -= st2;
-        st1 -= c_bit;
-        if (st1 < INT16_MIN || st1 > INT16_MAX)
-            V = 1;
-    }
-    else
-    {
-        st1 = (int8_t)t1;
-        st2 = (int8_t)t2;
-        t1 = (uint8_t)t1;
-        t2 = (uint8_t)t2;
-        t1 -= t2;
-        t1 -= c_bit;
-        C = (t1 >> 8) & 1;
-
-        t1 &= 0xff;
-        N = (t1 & 0x80) != 0;
-        Z = t1 == 0;
-
-        st1 -= st2;
-        st1 -= c_bit;
-        if (st1 < INT8_MIN || st1 > INT8_MAX)
-            V = 1;
-    }
-    mcu->MCU_SetStatus(N, STATUS_N);
-    mcu->MCU_SetStatus(Z, STATUS_Z);
-    mcu->MCU_SetStatus(C, STATUS_C);
-    mcu->MCU_SetStatus(V, STATUS_V);
-
-    return t1;
+    uint32_t mask = siz ? 0xffff : 0xff;
+    mcu->mcu.status_op = STATUS_OP_SUB;
+    mcu->mcu.status_siz = siz != 0;
+    mcu->mcu.status_c_bit = c_bit;
+    mcu->mcu.status_t1 = t1 & mask;
+    mcu->mcu.status_t2 = t2 & mask;
+
+    return (t1 - t2 - c_bit) & mask;
 }
 
 int32_t MCU_ADD_Common(MCU *mcu, int32_t t1, int32_t t2, int32_t c_bit, uint32_t siz)
 {
-    int32_t st1, st2;
-    int32_t N, Z, C, V = 0;
-    if (siz)
-    {
-        st1 = (int16_t)t1;
-        st2 = (int16_t)t2;
-        t1 = (uint16_t)t1;
-        t2 = (uint16_t)t2;
-        t1 += t2;
-        t1 += c_bit;
-        C = (t1 >> 16) & 1;
-
-        t1 &= 0xffff;
-        N = (t1 & 0x8000) != 0;
-        Z = t1 == 0;
-
-        st1 += st2;
-        st1 += c_bit;
-        if (st1 < INT16_MIN || st1 > INT16_MAX)
-            V = 1;
-    }
-    else
-    {
-        st1 = (int8_t)t1;
-        st2 = (int8_t)t2;
-        t1 = (uint8_t)t1;
-        t2 = (uint8_t)t2;
-        t1 += t2;
-        t1 += c_bit;
-        C = (t1 >> 8) & 1;
-
-        t1 &= 0xff;
-        N = (t1 & 0x80) != 0;
-        Z = t1 == 0;
-
-        st1 += st2;
-        st1 += c_bit;
-        if (st1 < INT8_MIN || st1 > INT8_MAX)
-            V = 1;
-    }
-    mcu->MCU_SetStatus(N, STATUS_N);
-    mcu->MCU_SetStatus(Z, STATUS_Z);
-    mcu->MCU_SetStatus(C, STATUS_C);
-    mcu->MCU_SetStatus(V, STATUS_V);
-
-    return t1;
+    uint32_t mask = siz ? 0xffff : 0xff;
+    mcu->mcu.status_op = STATUS_OP_ADD;
+    mcu->mcu.status_siz = siz != 0;
+    mcu->mcu.status_c_bit = c_bit;
+    mcu->mcu.status_t1 = t1 & mask;
+    mcu->mcu.status_t2 = t2 & mask;
+
+    return (t1 + t2 + c_bit) & mask;
 }
 
-void MCU_Operand_Nop(MCU *mcu, uint8_t operand)
+uint32_t MCU_Operand_Nop(MCU *mcu, uint8_t operand)
 {
+    return 2;
 }
 
-void MCU_Operand_Sleep(MCU *mcu, uint8_t operand)
+uint32_t MCU_Operand_Sleep(MCU *mcu, uint8_t operand)
 {
     mcu->mcu.sleep = 1;
+    return 2;
 }
 
-void MCU_Operand_NotImplemented(MCU *mcu, uint8_t operand)
+uint32_t MCU_Operand_NotImplemented(MCU *mcu, uint8_t operand)
 {
     mcu->MCU_ErrorTrap();
+    return 2;
 }
 
 enum {
@@ -168,9 +95,15 @@ enum {
     INCREASE_INCREASE
 };
 
-void MCU_LDM(MCU *mcu, uint8_t operand)
+enum {
+    OPERAND_STATUS_READ = 1,
+    OPERAND_STATUS_WRITE = 2
+};
+
+uint32_t MCU_LDM(MCU *mcu, uint8_t operand)
 {
     uint8_t rlist = mcu->MCU_ReadCodeAdvance();
+    uint32_t states = 6;
     int32_t i;
     for (i = 0; i < 8; i++)
     {
@@ -179,13 +112,16 @@ void MCU_LDM(MCU *mcu, uint8_t operand)
             uint16_t data = mcu->MCU_PopStack();
             if (i != 7)
                 mcu->mcu.r[i] = data;
+            states += 2;
         }
     }
+    return states;
 }
 
-void MCU_STM(MCU *mcu, uint8_t operand)
+uint32_t MCU_STM(MCU *mcu, uint8_t operand)
 {
     uint8_t rlist = mcu->MCU_ReadCodeAdvance();
+    uint32_t states = 6;
     int32_t i;
     for (i = 7; i >= 0; i--)
     {
@@ -195,11 +131,13 @@ void MCU_STM(MCU *mcu, uint8_t operand)
             if (i == 7)
                 data -= 2;
             mcu->MCU_PushStack(data);
+            states += 2;
         }
     }
+    return states;
 }
 
-void MCU_TRAPA(MCU *mcu, uint8_t operand)
+uint32_t MCU_TRAPA(MCU *mcu, uint8_t operand)
 {
     uint32_t opcode = mcu->MCU_ReadCodeAdvance();
     if ((opcode & 0xf0) == 0x10)
@@ -210,9 +148,10 @@ void MCU_TRAPA(MCU *mcu, uint8_t operand)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_LINK(MCU *mcu, uint8_t operand)
+uint32_t MCU_LINK(MCU *mcu, uint8_t operand)
 {
     if (operand == 0x17)
     {
@@ -220,6 +159,7 @@ void MCU_LINK(MCU *mcu, uint8_t operand)
         mcu->MCU_PushStack(mcu->mcu.r[6]);
         mcu->mcu.r[6] = mcu->mcu.r[7];
         mcu->mcu.r[7] += data;
+        return 6;
     }
     else if (operand == 0x1f)
     {
@@ -231,15 +171,17 @@ void MCU_LINK(MCU *mcu, uint8_t operand)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_UNLK(MCU *mcu, uint8_t operand)
+uint32_t MCU_UNLK(MCU *mcu, uint8_t operand)
 {
     mcu->mcu.r[7] = mcu->mcu.r[6];
     mcu->mcu.r[6] = mcu->MCU_PopStack();
+    return 5;
 }
 
-void MCU_Jump_PJSR(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_PJSR(MCU *mcu, uint8_t operand)
 {
     uint32_t ocp = mcu->mcu.cp;
     uint32_t opc = mcu->mcu.pc;
@@ -253,26 +195,34 @@ void MCU_Jump_PJSR(MCU *mcu, uint8_t operand)
     if (mcu->mcu.cp == 0x27)
         mcu->mcu.cp += 0;
     mcu->mcu.pc = address;
+    return 13;
 }
 
-void MCU_Jump_JSR(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_JSR(MCU *mcu, uint8_t operand)
 {
     uint16_t address;
     address = mcu->MCU_ReadCodeAdvance() << 8;
     address |= mcu->MCU_ReadCodeAdvance();
     mcu->MCU_PushStack(mcu->mcu.pc);
     mcu->mcu.pc = address;
+    return 9;
 }
 
-void MCU_Jump_RTE(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_RTE(MCU *mcu, uint8_t operand)
 {
     mcu->mcu.sr = mcu->MCU_PopStack();
+    mcu->mcu.status_op = STATUS_OP_NONE;
     mcu->mcu.cp = (uint8_t)mcu->MCU_PopStack();
     mcu->mcu.pc = mcu->MCU_PopStack();
     mcu->mcu.ex_ignore = 1;
+#ifdef MCU_PROFILER
+    if (mcu->profiler.enabled)
+        mcu->profiler.PROFILER_ReturnVector();
+#endif
+    return 13;
 }   
 
-void MCU_Jump_Bcc(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_Bcc(MCU *mcu, uint8_t operand)
 {
     uint16_t disp;
     uint32_t cond;
@@ -289,10 +239,11 @@ void MCU_Jump_Bcc(MCU *mcu, uint8_t operand)
     }
     cond = operand & 0x0f;
 
-    N = (mcu->mcu.sr & STATUS_N) != 0;
-    C = (mcu->mcu.sr & STATUS_C) != 0;
-    Z = (mcu->mcu.sr & STATUS_Z) != 0;
-    V = (mcu->mcu.sr & STATUS_V) != 0;
+    uint16_t sr = mcu->MCU_GetSR();
+    N = (sr & STATUS_N) != 0;
+    C = (sr & STATUS_C) != 0;
+    Z = (sr & STATUS_Z) != 0;
+    V = (sr & STATUS_V) != 0;
 
     switch (cond)
     {
@@ -346,18 +297,24 @@ void MCU_Jump_Bcc(MCU *mcu, uint8_t operand)
         break;
     }
 
+    uint32_t states = (operand & 0x10) ? 4 : 3;
     if (branch)
     {
         mcu->mcu.pc += disp;
+        if ((int16_t)disp < 0 && (int16_t)disp >= -IDLE_LOOP_MAX_SIZE)
+            mcu->idle_branch = 1;
+        states += 2;
     }
+    return states;
 }
 
-void MCU_Jump_RTS(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_RTS(MCU *mcu, uint8_t operand)
 {
     mcu->mcu.pc = mcu->MCU_PopStack();
+    return 8;
 }
 
-void MCU_Jump_RTD(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_RTD(MCU *mcu, uint8_t operand)
 {
     int16_t imm = (int8_t)mcu->MCU_ReadCodeAdvance();
     mcu->mcu.pc = mcu->MCU_PopStack();
@@ -377,45 +334,52 @@ void MCU_Jump_RTD(MCU *mcu, uint8_t operand)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 9;
 }
 
-void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_JMP(MCU *mcu, uint8_t operand)
 {
     if (operand == 0x11)
     {
         uint8_t opcode = mcu->MCU_ReadCodeAdvance();
         uint8_t opcode_h = opcode >> 3;
         uint8_t opcode_l = opcode & 0x07;
-        if (opcode == 0x19)
+        if (opcode == 0x19) // PRTS
         {
             mcu->mcu.cp = (uint8_t)mcu->MCU_PopStack();
             mcu->mcu.pc = mcu->MCU_PopStack();
+            return 12;
         }
-        else if (opcode_h == 0x18)
+        else if (opcode_h == 0x18) // PJMP @Rn
         {
             mcu->mcu.cp = mcu->mcu.r[opcode_l] & 0xff;
             mcu->mcu.pc = mcu->mcu.r[opcode_l + 1];
+            return 5;
         }
-        else if (opcode_h == 0x19)
+        else if (opcode_h == 0x19) // PJSR @Rn
         {
             mcu->MCU_PushStack(mcu->mcu.pc);
             mcu->MCU_PushStack(mcu->mcu.cp);
             opcode_l &= ~1;
             mcu->mcu.cp = mcu->mcu.r[opcode_l] & 0xff;
             mcu->mcu.pc = mcu->mcu.r[opcode_l + 1];
+            return 12;
         }
-        else if (opcode_h == 0x1a)
+        else if (opcode_h == 0x1a) // JMP @Rn
         {
             mcu->mcu.pc = mcu->mcu.r[opcode_l];
+            return 4;
         }
-        else if (opcode_h == 0x1b)
+        else if (opcode_h == 0x1b) // JSR @Rn
         {
             mcu->MCU_PushStack(mcu->mcu.pc);
             mcu->mcu.pc = mcu->mcu.r[opcode_l];
+            return 8;
         }
         else if (opcode_h == 0x1c)
         {
             mcu->mcu.pc = mcu->mcu.r[opcode_l] + mcu->MCU_ReadCodeAdvance();
+            return 5;
         }
         else if (opcode_h == 0x1e)
         {
@@ -423,6 +387,7 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
             addr = mcu->MCU_ReadCodeAdvance() << 8;
             addr |= mcu->MCU_ReadCodeAdvance();
             mcu->mcu.pc = mcu->mcu.r[opcode_l] + addr;
+            return 6;
         }
         else
         {
@@ -441,7 +406,9 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
             if (mcu->mcu.r[reg] != 0xffff)
             {
                 mcu->mcu.pc += disp;
+                return 5;
             }
+            return 3;
         }
         else
         {
@@ -454,6 +421,7 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
         addr = mcu->MCU_ReadCodeAdvance() << 8;
         addr |= mcu->MCU_ReadCodeAdvance();
         mcu->mcu.pc = addr;
+        return 5;
     }
     else if (operand == 0x06)
     {
@@ -463,15 +431,17 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
         if (opcode == 0x17)
         {
             uint16_t disp = (int8_t)mcu->MCU_ReadCodeAdvance();
-            uint32_t Z = (mcu->mcu.sr & STATUS_Z) != 0;
+            uint32_t Z = (mcu->MCU_GetSR() & STATUS_Z) != 0;
             if (Z)
             {
                 mcu->mcu.r[reg]--;
                 if (mcu->mcu.r[reg] != 0xffff)
                 {
                     mcu->mcu.pc += disp;
+                    return 5;
                 }
             }
+            return 3;
         }
         else
         {
@@ -486,15 +456,17 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
         if (opcode == 0x17)
         {
             uint16_t disp = (int8_t)mcu->MCU_ReadCodeAdvance();
-            uint32_t Z = (mcu->mcu.sr & STATUS_Z) != 0;
+            uint32_t Z = (mcu->MCU_GetSR() & STATUS_Z) != 0;
             if (!Z)
             {
                 mcu->mcu.r[reg]--;
                 if (mcu->mcu.r[reg] != 0xffff)
                 {
                     mcu->mcu.pc += disp;
+                    return 5;
                 }
             }
+            return 3;
         }
         else
         {
@@ -505,9 +477,10 @@ void MCU_Jump_JMP(MCU *mcu, uint8_t operand)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Jump_BSR(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_BSR(MCU *mcu, uint8_t operand)
 {
     uint16_t disp;
     if (operand == 0x0e)
@@ -521,9 +494,10 @@ void MCU_Jump_BSR(MCU *mcu, uint8_t operand)
     }
     mcu->MCU_PushStack(mcu->mcu.pc);
     mcu->mcu.pc += disp;
+    return 9;
 }
 
-void MCU_Jump_PJMP(MCU *mcu, uint8_t operand)
+uint32_t MCU_Jump_PJMP(MCU *mcu, uint8_t operand)
 {
     uint8_t page;
     uint16_t address;
@@ -532,6 +506,7 @@ void MCU_Jump_PJMP(MCU *mcu, uint8_t operand)
     address |= mcu->MCU_ReadCodeAdvance();
     mcu->mcu.cp = page;
     mcu->mcu.pc = address;
+    return 6;
 }
 
 uint32_t MCU_Operand_Read(MCU *mcu)
@@ -544,6 +519,7 @@ uint32_t MCU_Operand_Read(MCU *mcu)
         return mcu->mcu.r[mcu->operand_reg] & 0xff;
     case GENERAL_INDIRECT:
     case GENERAL_ABSOLUTE:
+        mcu->operand_status |= OPERAND_STATUS_READ;
         if (mcu->operand_size)
         {
             if (mcu->operand_ea & 1)
@@ -574,6 +550,7 @@ void MCU_Operand_Write(MCU *mcu, uint32_t data)
         break;
     case GENERAL_INDIRECT:
     case GENERAL_ABSOLUTE:
+        mcu->operand_status |= OPERAND_STATUS_WRITE;
         if (mcu->operand_size)
         {
             if (mcu->operand_ea & 1)
@@ -591,21 +568,14 @@ void MCU_Operand_Write(MCU *mcu, uint32_t data)
     }
 }
 
-void MCU_Operand_General(MCU *mcu, uint8_t operand)
+static void MCU_Operand_DecodeGeneral(MCU *mcu, uint8_t operand, mcu_decode_t *decode)
 {
     uint32_t type = GENERAL_DIRECT;
     uint32_t disp = 0;
-    uint32_t increase = INCREASE_NONE;
-    uint32_t absolute = 0;
+    uint32_t mode = INCREASE_NONE;
     uint32_t reg = 0;
     uint32_t siz = OPERAND_BYTE;
-    uint32_t data = 0;
-    uint32_t addr = 0;
-    uint32_t addrpage = 0;
-    uint32_t ea = 0;
-    uint32_t ep = 0;
     uint8_t opcode;
-    uint8_t opcode_reg;
     if (operand & 0x08)
         siz = OPERAND_WORD;
     else
@@ -631,44 +601,95 @@ void MCU_Operand_General(MCU *mcu, uint8_t operand)
         break;
     case 0xb0:
         type = GENERAL_INDIRECT;
-        increase = INCREASE_DECREASE;
+        mode = INCREASE_DECREASE;
         break;
     case 0xc0:
         type = GENERAL_INDIRECT;
-        increase = INCREASE_INCREASE;
+        mode = INCREASE_INCREASE;
         break;
     case 0x00:
         if (reg == 5)
         {
+            // @aa:8, page 0, high byte from br
             type = GENERAL_ABSOLUTE;
-            addr = mcu->mcu.br << 8;
-            addr |= mcu->MCU_ReadCodeAdvance();
-            addrpage = 0;
+            disp = mcu->MCU_ReadCodeAdvance();
+            mode = 0;
         }
         else if (reg == 4)
         {
             type = GENERAL_IMMEDIATE;
-            data = mcu->MCU_ReadCodeAdvance();
+            disp = mcu->MCU_ReadCodeAdvance();
             if (siz)
             {
-                data <<= 8;
-                data |= mcu->MCU_ReadCodeAdvance();
+                disp <<= 8;
+                disp |= mcu->MCU_ReadCodeAdvance();
             }
         }
         break;
     case 0x10:
         if (reg == 5)
         {
+            // @aa:16, page from dp
             type = GENERAL_ABSOLUTE;
-            addr = mcu->MCU_ReadCodeAdvance() << 8;
-            addr |= mcu->MCU_ReadCodeAdvance();
-            addrpage = mcu->mcu.dp;
+            disp = mcu->MCU_ReadCodeAdvance() << 8;
+            disp |= mcu->MCU_ReadCodeAdvance();
+            mode = 1;
         }
         break;
     }
+
+    opcode = mcu->MCU_ReadCodeAdvance();
+    decode->opcode_extended = opcode == 0x00;
+    if (decode->opcode_extended)
+    {
+        opcode = mcu->MCU_ReadCodeAdvance();
+    }
+    decode->opcode_reg = opcode & 0x07;
+    decode->opcode = opcode >> 3;
+
+    decode->type = type;
+    decode->disp = disp;
+    decode->mode = mode;
+    decode->reg = reg;
+    decode->siz = siz;
+}
+
+// Effective address calculation and the first operand access, added to
+// the register direct states returned by the MCU_Opcode_Table handlers
+static uint32_t MCU_Operand_EAStates(const mcu_decode_t *decode)
+{
+    switch (decode->operand & 0xf0)
+    {
+    case 0x00:
+        if (decode->type == GENERAL_IMMEDIATE)
+            return decode->siz ? 2 : 1; // #xx:16, #xx:8
+        return 3; // @aa:8
+    case 0x10:
+        return 4; // @aa:16
+    case 0xb0: // @-Rn
+    case 0xc0: // @Rn+
+        return 3;
+    case 0xd0:
+        return 2; // @Rn
+    case 0xe0:
+        return 3; // @(d:8,Rn)
+    case 0xf0:
+        return 4; // @(d:16,Rn)
+    }
+    return 0; // Rn
+}
+
+static uint32_t MCU_Operand_ExecuteGeneral(MCU *mcu, const mcu_decode_t *decode)
+{
+    uint32_t type = decode->type;
+    uint32_t reg = decode->reg;
+    uint32_t siz = decode->siz;
+    uint32_t data = 0;
+    uint32_t ea = 0;
+    uint32_t ep = 0;
     if (type == GENERAL_INDIRECT)
     {
-        if (increase == INCREASE_DECREASE)
+        if (decode->mode == INCREASE_DECREASE)
         {
             if (siz || reg == 7)
             {
@@ -679,8 +700,8 @@ void MCU_Operand_General(MCU *mcu, uint8_t operand)
                 mcu->mcu.r[reg] -= 1;
             }
         }
-        ea = mcu->mcu.r[reg] + disp;
-        if (increase == INCREASE_INCREASE)
+        ea = mcu->mcu.r[reg] + decode->disp;
+        if (decode->mode == INCREASE_INCREASE)
         {
             if (siz || reg == 7)
             {
@@ -698,20 +719,23 @@ void MCU_Operand_General(MCU *mcu, uint8_t operand)
     }
     else if (type == GENERAL_ABSOLUTE)
     {
-        ea = addr & 0xffff;
-
-        ep = addrpage & 0xff;
+        if (decode->mode)
+        {
+            ea = decode->disp;
+            ep = mcu->mcu.dp;
+        }
+        else
+        {
+            ea = (mcu->mcu.br << 8) | decode->disp;
+            ep = 0;
+        }
     }
-
-    opcode = mcu->MCU_ReadCodeAdvance();
-    mcu->opcode_extended = opcode == 0x00;
-    if (mcu->opcode_extended)
+    else if (type == GENERAL_IMMEDIATE)
     {
-        opcode = mcu->MCU_ReadCodeAdvance();
+        data = decode->disp;
     }
-    opcode_reg = opcode & 0x07;
-    opcode >>= 3;
 
+    mcu->opcode_extended = decode->opcode_extended;
     mcu->operand_type = type;
     mcu->operand_ea = ea;
     mcu->operand_ep = ep;
@@ -720,38 +744,68 @@ void MCU_Operand_General(MCU *mcu, uint8_t operand)
     mcu->operand_data = data;
     mcu->operand_status = 0;
 
-    MCU_Opcode_Table[opcode](mcu, opcode, opcode_reg);
+    uint32_t states = MCU_Opcode_Table[decode->opcode](mcu, decode->opcode, decode->opcode_reg);
+    states += MCU_Operand_EAStates(decode);
+    if (mcu->operand_status == (OPERAND_STATUS_READ | OPERAND_STATUS_WRITE))
+        states += 2; // read-modify-write
+    return states;
+}
+
+uint32_t MCU_Operand_General(MCU *mcu, uint8_t operand)
+{
+    mcu_decode_t decode;
+    decode.operand = operand;
+    MCU_Operand_DecodeGeneral(mcu, operand, &decode);
+    return MCU_Operand_ExecuteGeneral(mcu, &decode);
+}
+
+// Reads the operand byte and, for general format instructions, the effective
+// address and opcode bytes. Everything else is left for the handler to fetch.
+void MCU_Operand_Decode(MCU *mcu, mcu_decode_t *decode)
+{
+    uint16_t pc = mcu->mcu.pc;
+    uint8_t operand = mcu->MCU_ReadCodeAdvance();
+    decode->operand = operand;
+    decode->general = MCU_Operand_Table[operand] == MCU_Operand_General;
+    if (decode->general)
+        MCU_Operand_DecodeGeneral(mcu, operand, decode);
+    decode->length = (uint16_t)(mcu->mcu.pc - pc);
+}
+
+uint32_t MCU_Operand_Execute(MCU *mcu, const mcu_decode_t *decode)
+{
+    if (decode->general)
+        return MCU_Operand_ExecuteGeneral(mcu, decode);
+    return MCU_Operand_Table[decode->operand](mcu, decode->operand);
 }
 
 void MCU_SetStatusCommon(MCU *mcu, uint32_t val, uint32_t siz)
 {
-    if (siz)
-        val &= 0xffff;
-    else
-        val &= 0xff;
-    if (siz)
-        mcu->MCU_SetStatus(val & 0x8000, STATUS_N);
-    else
-        mcu->MCU_SetStatus(val & 0x80, STATUS_N);
-    mcu->MCU_SetStatus(val == 0, STATUS_Z);
-    mcu->MCU_SetStatus(0, STATUS_V);
+    // C is kept, it may still be pending
+    if (mcu->mcu.status_op == STATUS_OP_ADD || mcu->mcu.status_op == STATUS_OP_SUB)
+        mcu->MCU_EvaluateStatus();
+    mcu->mcu.status_op = STATUS_OP_LOGIC;
+    mcu->mcu.status_siz = siz != 0;
+    mcu->mcu.status_t1 = val;
 }
 
-void MCU_Opcode_Short_NotImplemented(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_NotImplemented(MCU *mcu, uint8_t opcode)
 {
     mcu->MCU_ErrorTrap();
+    return 2;
 }
 
-void MCU_Opcode_Short_MOVE(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_MOVE(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint8_t data = mcu->MCU_ReadCodeAdvance();
     mcu->mcu.r[reg] &= ~0xff;
     mcu->mcu.r[reg] |= data;
     MCU_SetStatusCommon(mcu, data, 0);
+    return 2;
 }
 
-void MCU_Opcode_Short_MOVI(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_MOVI(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint16_t data;
@@ -759,9 +813,10 @@ void MCU_Opcode_Short_MOVI(MCU *mcu, uint8_t opcode)
     data |= mcu->MCU_ReadCodeAdvance();
     mcu->mcu.r[reg] = data;
     MCU_SetStatusCommon(mcu, data, 1);
+    return 3;
 }
 
-void MCU_Opcode_Short_MOVF(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_MOVF(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint32_t siz = (opcode & 0x08) != 0;
@@ -801,9 +856,10 @@ void MCU_Opcode_Short_MOVF(MCU *mcu, uint8_t opcode)
             MCU_SetStatusCommon(mcu, data, 1);
         }
     }
+    return 4;
 }
 
-void MCU_Opcode_Short_MOVL(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_MOVL(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint32_t siz = (opcode & 0x08) != 0;
@@ -825,9 +881,10 @@ void MCU_Opcode_Short_MOVL(MCU *mcu, uint8_t opcode)
         mcu->mcu.r[reg] |= data;
         MCU_SetStatusCommon(mcu, data, 0);
     }
+    return 3;
 }
 
-void MCU_Opcode_Short_MOVS(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_MOVS(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint32_t siz = (opcode & 0x08) != 0;
@@ -848,9 +905,10 @@ void MCU_Opcode_Short_MOVS(MCU *mcu, uint8_t opcode)
         mcu->MCU_Write(addr, data);
         MCU_SetStatusCommon(mcu, data, 0);
     }
+    return 3;
 }
 
-void MCU_Opcode_Short_CMP(MCU *mcu, uint8_t opcode)
+uint32_t MCU_Opcode_Short_CMP(MCU *mcu, uint8_t opcode)
 {
     uint32_t reg = opcode & 0x07;
     uint32_t siz = (opcode & 0x08) != 0;
@@ -866,14 +924,16 @@ void MCU_Opcode_Short_CMP(MCU *mcu, uint8_t opcode)
     }
     t1 = mcu->mcu.r[reg];
     MCU_SUB_Common(mcu, t1, t2, 0, siz);
+    return siz ? 3 : 2;
 }
 
-void MCU_Opcode_NotImplemented(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_NotImplemented(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     mcu->MCU_ErrorTrap();
+    return 2;
 }
 
-void MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t data;
     if (opcode_reg == 6 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE))
@@ -881,6 +941,7 @@ void MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         data = (int8_t)mcu->MCU_ReadCodeAdvance();
         MCU_Operand_Write(mcu, data);
         MCU_SetStatusCommon(mcu, data, mcu->operand_size);
+        return 3;
     }
     else if (opcode_reg == 7 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE))
     {
@@ -888,18 +949,21 @@ void MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         data |= mcu->MCU_ReadCodeAdvance();
         MCU_Operand_Write(mcu, data);
         MCU_SetStatusCommon(mcu, data, mcu->operand_size);
+        return 4;
     }
     else if (opcode_reg == 4 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE) && mcu->operand_size == OPERAND_BYTE)
     {
         uint32_t t1 = MCU_Operand_Read(mcu);
         uint32_t t2 = mcu->MCU_ReadCodeAdvance();
         MCU_SUB_Common(mcu, t1, t2, 0, OPERAND_BYTE);
+        return 3;
     }
     else if (opcode_reg == 4 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE) && mcu->operand_size == OPERAND_WORD) // FIXME
     {
         uint32_t t1 = MCU_Operand_Read(mcu);
         uint32_t t2 = (uint16_t)(int8_t)mcu->MCU_ReadCodeAdvance();
         MCU_SUB_Common(mcu, t1, t2, 0, OPERAND_WORD);
+        return 3;
     }
     else if (opcode_reg == 5 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE) && mcu->operand_size == OPERAND_WORD)
     {
@@ -908,6 +972,7 @@ void MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         t2 = mcu->MCU_ReadCodeAdvance() << 8;
         t2 |= mcu->MCU_ReadCodeAdvance();
         MCU_SUB_Common(mcu, t1, t2, 0, OPERAND_WORD);
+        return 4;
     }
     else if (opcode_reg == 5 && (mcu->operand_type == GENERAL_INDIRECT || mcu->operand_type == GENERAL_ABSOLUTE) && mcu->operand_size == OPERAND_BYTE) // FIXME
     {
@@ -916,14 +981,16 @@ void MCU_Opcode_MOVG_Immediate(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         t2 = mcu->MCU_ReadCodeAdvance() << 8;
         t2 |= mcu->MCU_ReadCodeAdvance();
         MCU_SUB_Common(mcu, t1, t2, 0, OPERAND_BYTE);
+        return 4;
     }
     else
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Opcode_BSET_ORC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BSET_ORC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type == GENERAL_IMMEDIATE) // ORC
     {
@@ -945,9 +1012,10 @@ void MCU_Opcode_BSET_ORC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         data |= 1 << bit;
         MCU_Operand_Write(mcu, data);
     }
+    return 3;
 }
 
-void MCU_Opcode_BCLR_ANDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BCLR_ANDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type == GENERAL_IMMEDIATE) // ANDC
     {
@@ -969,9 +1037,10 @@ void MCU_Opcode_BCLR_ANDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         data &= ~(1 << bit);
         MCU_Operand_Write(mcu, data);
     }
+    return 3;
 }
 
-void MCU_Opcode_BTST(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BTST(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type != GENERAL_IMMEDIATE)
     {
@@ -983,9 +1052,10 @@ void MCU_Opcode_BTST(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Opcode_CLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_CLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (opcode_reg == 3 && mcu->operand_type != GENERAL_IMMEDIATE) // CLR
     {
@@ -1042,9 +1112,10 @@ void MCU_Opcode_CLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Opcode_LDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_LDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     // FIXME: Check also other cases
     if (mcu->operand_reg == 7 && opcode_reg == 4)
@@ -1060,9 +1131,10 @@ void MCU_Opcode_LDC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->MCU_ControlRegisterWrite(opcode_reg, mcu->operand_size, data);
     }
     mcu->mcu.ex_ignore = 1;
+    return 3;
 }
 
-void MCU_Opcode_STC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_STC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     // FIXME: Check also other cases
     if (mcu->operand_reg == 7 && opcode_reg == 4)
@@ -1077,9 +1149,10 @@ void MCU_Opcode_STC(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         uint32_t data = mcu->MCU_ControlRegisterRead(opcode_reg, mcu->operand_size);
         MCU_Operand_Write(mcu, data);
     }
+    return 2;
 }
 
-void MCU_Opcode_BSET(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BSET(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type != GENERAL_IMMEDIATE)
     {
@@ -1093,9 +1166,10 @@ void MCU_Opcode_BSET(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 3;
 }
 
-void MCU_Opcode_BCLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BCLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type != GENERAL_IMMEDIATE)
     {
@@ -1109,9 +1183,10 @@ void MCU_Opcode_BCLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 3;
 }
 
-void MCU_Opcode_MOVG(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_MOVG(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->opcode_extended)
     {
@@ -1165,9 +1240,10 @@ void MCU_Opcode_MOVG(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
             MCU_SetStatusCommon(mcu, data, mcu->operand_size);
         }
     }
+    return 2;
 }
 
-void MCU_Opcode_BTSTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BTSTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type != GENERAL_IMMEDIATE)
     {
@@ -1179,9 +1255,10 @@ void MCU_Opcode_BTSTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Opcode_BNOTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_BNOTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (mcu->operand_type != GENERAL_IMMEDIATE)
     {
@@ -1195,23 +1272,26 @@ void MCU_Opcode_BNOTI(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 3;
 }
 
-void MCU_Opcode_OR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_OR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t data = MCU_Operand_Read(mcu);
     mcu->mcu.r[opcode_reg] |= data;
     MCU_SetStatusCommon(mcu, mcu->mcu.r[opcode_reg], mcu->operand_size);
+    return 2;
 }
 
-void MCU_Opcode_CMP(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_CMP(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
     MCU_SUB_Common(mcu, t1, t2, 0, mcu->operand_size);
+    return 2;
 }
 
-void MCU_Opcode_ADDQ(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_ADDQ(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = MCU_Operand_Read(mcu);
     int32_t t2 = 0;
@@ -1235,9 +1315,10 @@ void MCU_Opcode_ADDQ(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     }
     t1 = MCU_ADD_Common(mcu, t1, t2, 0, mcu->operand_size);
     MCU_Operand_Write(mcu, t1);
+    return 2;
 }
 
-void MCU_Opcode_ADD(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_ADD(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
@@ -1249,9 +1330,10 @@ void MCU_Opcode_ADD(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] &= ~0xff;
         mcu->mcu.r[opcode_reg] |= t1 & 0xff;
     }
+    return 2;
 }
 
-void MCU_Opcode_SUB(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_SUB(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
@@ -1263,9 +1345,10 @@ void MCU_Opcode_SUB(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] &= ~0xff;
         mcu->mcu.r[opcode_reg] |= t1 & 0xff;
     }
+    return 2;
 }
 
-void MCU_Opcode_SUBS(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_SUBS(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
@@ -1273,9 +1356,10 @@ void MCU_Opcode_SUBS(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] = t1 - t2;
     else
         mcu->mcu.r[opcode_reg] = t1 - (int8_t)t2;
+    return 2;
 }
 
-void MCU_Opcode_AND(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_AND(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t data = mcu->mcu.r[opcode_reg];
     data &= MCU_Operand_Read(mcu);
@@ -1287,9 +1371,10 @@ void MCU_Opcode_AND(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] |= data & 0xff;
     }
     MCU_SetStatusCommon(mcu, mcu->mcu.r[opcode_reg], mcu->operand_size);
+    return 2;
 }
 
-void MCU_Opcode_SHLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_SHLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     if (opcode_reg == 0x03 && mcu->operand_type != GENERAL_IMMEDIATE) // SHLR
     {
@@ -1316,7 +1401,7 @@ void MCU_Opcode_SHLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     else if (opcode_reg == 0x06 && mcu->operand_type != GENERAL_IMMEDIATE) // ROTXL
     {
         uint32_t data = MCU_Operand_Read(mcu);
-        uint32_t bit = (mcu->mcu.sr & STATUS_C) != 0;
+        uint32_t bit = (mcu->MCU_GetSR() & STATUS_C) != 0;
         uint32_t C;
         if (mcu->operand_size)
             C = (data & 0x8000) != 0;
@@ -1331,7 +1416,7 @@ void MCU_Opcode_SHLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     else if (opcode_reg == 0x07 && mcu->operand_type != GENERAL_IMMEDIATE) // ROTXR
     {
         uint32_t data = MCU_Operand_Read(mcu);
-        uint32_t bit = (mcu->mcu.sr & STATUS_C) != 0;
+        uint32_t bit = (mcu->MCU_GetSR() & STATUS_C) != 0;
         uint32_t C = data & 0x1;
         data >>= 1;
         if (mcu->operand_size)
@@ -1407,9 +1492,10 @@ void MCU_Opcode_SHLR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     {
         mcu->MCU_ErrorTrap();
     }
+    return 2;
 }
 
-void MCU_Opcode_MULXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_MULXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t t1 = MCU_Operand_Read(mcu);
     uint32_t t2 = mcu->mcu.r[opcode_reg];
@@ -1436,13 +1522,15 @@ void MCU_Opcode_MULXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
     mcu->MCU_SetStatus(Z, STATUS_Z);
     mcu->MCU_SetStatus(0, STATUS_V);
     mcu->MCU_SetStatus(0, STATUS_C);
+    return mcu->operand_size ? 24 : 16;
 }
 
-void MCU_Opcode_DIVXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_DIVXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t t1 = MCU_Operand_Read(mcu);
     uint32_t t2;
     uint32_t R, Q;
+    uint32_t states = mcu->operand_size ? 28 : 20;
 
     if (!t1)
     {
@@ -1451,7 +1539,7 @@ void MCU_Opcode_DIVXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->MCU_SetStatus(1, STATUS_Z);
         mcu->MCU_SetStatus(0, STATUS_V);
         mcu->MCU_SetStatus(0, STATUS_C);
-        return;
+        return states;
     }
 
     if (mcu->operand_size)
@@ -1501,29 +1589,32 @@ void MCU_Opcode_DIVXU(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
             mcu->MCU_SetStatus(0, STATUS_C);
         }
     }
+    return states;
 }
 
-void MCU_Opcode_ADDS(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_ADDS(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t data = MCU_Operand_Read(mcu);
     if (!mcu->operand_size)
         data = (int8_t)data;
     mcu->mcu.r[opcode_reg] += data;
+    return 2;
 }
 
-void MCU_Opcode_XOR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_XOR(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     uint32_t data = MCU_Operand_Read(mcu);
     mcu->mcu.r[opcode_reg] ^= data;
     MCU_SetStatusCommon(mcu, mcu->mcu.r[opcode_reg], mcu->operand_size);
+    return 2;
 }
 
-void MCU_Opcode_ADDX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_ADDX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
-    int32_t C = (mcu->mcu.sr & STATUS_C) != 0;
-    int32_t Z = (mcu->mcu.sr & STATUS_Z) != 0;
+    int32_t C = (mcu->MCU_GetSR() & STATUS_C) != 0;
+    int32_t Z = (mcu->MCU_GetSR() & STATUS_Z) != 0;
     t1 = MCU_ADD_Common(mcu, t1, t2, C, mcu->operand_size);
     if (!Z)
         mcu->MCU_SetStatus(0, STATUS_Z);
@@ -1535,13 +1626,14 @@ void MCU_Opcode_ADDX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] &= ~0xff;
         mcu->mcu.r[opcode_reg] |= t1 & 0xff;
     }
+    return 2;
 }
 
-void MCU_Opcode_SUBX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
+uint32_t MCU_Opcode_SUBX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
 {
     int32_t t1 = mcu->mcu.r[opcode_reg];
     int32_t t2 = MCU_Operand_Read(mcu);
-    int32_t C = (mcu->mcu.sr & STATUS_C) != 0;
+    int32_t C = (mcu->MCU_GetSR() & STATUS_C) != 0;
     t1 = MCU_SUB_Common(mcu, t1, t2, C, mcu->operand_size);
     if (mcu->operand_size)
         mcu->mcu.r[opcode_reg] = t1;
@@ -1550,9 +1642,10 @@ void MCU_Opcode_SUBX(MCU *mcu, uint8_t opcode, uint8_t opcode_reg)
         mcu->mcu.r[opcode_reg] &= ~0xff;
         mcu->mcu.r[opcode_reg] |= t1 & 0xff;
     }
+    return 2;
 }
 
-void (*MCU_Operand_Table[256])(MCU *_this, uint8_t operand) = {
+uint32_t (*MCU_Operand_Table[256])(MCU *_this, uint8_t operand) = {
     MCU_Operand_Nop, // 00
     MCU_Jump_JMP, // 01
     MCU_LDM, // 02
@@ -1811,7 +1904,7 @@ void (*MCU_Operand_Table[256])(MCU *_this, uint8_t operand) = {
     MCU_Operand_General, // FF
 };
 
-void (*MCU_Opcode_Table[32])(MCU *_this, uint8_t opcode, uint8_t opcode_reg) = {
+uint32_t (*MCU_Opcode_Table[32])(MCU *_this, uint8_t opcode, uint8_t opcode_reg) = {
     MCU_Opcode_MOVG_Immediate, // 00
     MCU_Opcode_ADDQ, // 01
     MCU_Opcode_CLR, // 02
@@ -36,6 +36,11 @@
 #include <stdint.h>
 
 struct MCU;
+struct mcu_decode_t;
 
-extern void (*MCU_Operand_Table[256])(MCU *_this, uint8_t operand);
-extern void (*MCU_Opcode_Table[32])(MCU *_this, uint8_t opcode, uint8_t opcode_reg);
+// Handlers return the number of states the instruction takes
+extern uint32_t (*MCU_Operand_Table[256])(MCU *_this, uint8_t operand);
+extern uint32_t (*MCU_Opcode_Table[32])(MCU *_this, uint8_t opcode, uint8_t opcode_reg);
+
+void MCU_Operand_Decode(MCU *mcu, mcu_decode_t *decode);
+uint32_t MCU_Operand_Execute(MCU *mcu, const mcu_decode_t *decode);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef MCU_PROFILER
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "mcu.h"
+#include "mcu_profiler.h"
+
+MCU_Profiler::~MCU_Profiler()
+{
+    free(address_counts);
+}
+
+// Not to be called from the audio thread, enabling allocates the histogram
+void MCU_Profiler::PROFILER_Enable(bool enable)
+{
+    if (enable && !address_counts)
+    {
+        address_counts = (profiler_count_t *)calloc(PROFILER_ADDRESS_SPACE, sizeof(profiler_count_t));
+        if (!address_counts)
+        {
+            printf("Cannot allocate profiler histogram\n");
+            return;
+        }
+    }
+    enabled = enable;
+}
+
+void MCU_Profiler::PROFILER_Reset(void)
+{
+    instructions = 0;
+    cycles = 0;
+    if (address_counts)
+        memset(address_counts, 0, PROFILER_ADDRESS_SPACE * sizeof(profiler_count_t));
+    memset(opcode_counts, 0, sizeof(opcode_counts));
+    memset(vector_counts, 0, sizeof(vector_counts));
+    vector_depth = 0;
+}
+
+void MCU_Profiler::PROFILER_Instruction(uint32_t address, const mcu_decode_t *decode, uint32_t cycles)
+{
+    instructions++;
+    this->cycles += cycles;
+
+    profiler_count_t *count = &address_counts[address & (PROFILER_ADDRESS_SPACE - 1)];
+    count->count++;
+    count->cycles += cycles;
+
+    count = &opcode_counts[decode->general ? 256 + decode->opcode : decode->operand];
+    count->count++;
+    count->cycles += cycles;
+}
+
+void MCU_Profiler::PROFILER_EnterVector(uint32_t vector)
+{
+    if (vector_depth == PROFILER_NESTING)
+        return;
+    vector_stack[vector_depth].vector = vector;
+    vector_stack[vector_depth].entry_cycles = mcu->mcu.cycles;
+    vector_stack[vector_depth].nested_cycles = 0;
+    vector_depth++;
+}
+
+void MCU_Profiler::PROFILER_ReturnVector(void)
+{
+    if (vector_depth == 0)
+        return;
+    vector_depth--;
+    uint64_t elapsed = mcu->mcu.cycles - vector_stack[vector_depth].entry_cycles;
+    profiler_vector_t *count = &vector_counts[vector_stack[vector_depth].vector % PROFILER_VECTORS];
+    count->count++;
+    count->cycles += elapsed;
+    count->self_cycles += elapsed - vector_stack[vector_depth].nested_cycles;
+    if (vector_depth > 0)
+        vector_stack[vector_depth - 1].nested_cycles += elapsed;
+}
+
+// Writes the addresses (up to max_addresses, all if 0), opcodes and
+// vectors, each sorted by cycles spent
+void MCU_Profiler::PROFILER_Report(FILE *file, int format, int max_addresses)
+{
+    double total = cycles ? (double)cycles : 1.0;
+    bool csv = format == PROFILER_REPORT_CSV;
+
+    if (csv)
+        fprintf(file, "section,key,count,cycles,self_cycles,percent\n");
+    else
+        fprintf(file, "instructions %llu cycles %llu\n", (unsigned long long)instructions, (unsigned long long)cycles);
+
+    std::vector<uint32_t> order;
+    if (address_counts)
+    {
+        for (uint32_t i = 0; i < PROFILER_ADDRESS_SPACE; i++)
+        {
+            if (address_counts[i].count)
+                order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return address_counts[a].cycles > address_counts[b].cycles;
+    });
+    if (max_addresses > 0 && order.size() > (size_t)max_addresses)
+        order.resize(max_addresses);
+    if (!csv)
+        fprintf(file, "\naddress         count        cycles      %%\n");
+    for (uint32_t i : order)
+    {
+        const profiler_count_t &c = address_counts[i];
+        fprintf(file, csv ? "address,%02x:%04x,%llu,%llu,,%.3f\n" : "%02x:%04x  %12llu  %12llu  %6.3f\n",
+            i >> 16, i & 0xffff, (unsigned long long)c.count, (unsigned long long)c.cycles,
+            c.cycles * 100.0 / total);
+    }
+
+    order.clear();
+    for (uint32_t i = 0; i < PROFILER_OPCODES; i++)
+    {
+        if (opcode_counts[i].count)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return opcode_counts[a].cycles > opcode_counts[b].cycles;
+    });
+    if (!csv)
+        fprintf(file, "\nopcode          count        cycles      %%\n");
+    for (uint32_t i : order)
+    {
+        const profiler_count_t &c = opcode_counts[i];
+        char key[8];
+        // general format instructions are keyed by their opcode byte
+        snprintf(key, sizeof(key), i >= 256 ? "xx %02x" : "%02x", i & 0xff);
+        fprintf(file, csv ? "opcode,%s,%llu,%llu,,%.3f\n" : "%-7s  %12llu  %12llu  %6.3f\n",
+            key, (unsigned long long)c.count, (unsigned long long)c.cycles,
+            c.cycles * 100.0 / total);
+    }
+
+    order.clear();
+    for (uint32_t i = 0; i < PROFILER_VECTORS; i++)
+    {
+        if (vector_counts[i].count)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return vector_counts[a].self_cycles > vector_counts[b].self_cycles;
+    });
+    if (!csv)
+        fprintf(file, "\nvector          count        cycles   self cycles      %%\n");
+    for (uint32_t i : order)
+    {
+        const profiler_vector_t &c = vector_counts[i];
+        fprintf(file, csv ? "vector,%02x,%llu,%llu,%llu,%.3f\n" : "%02x       %12llu  %12llu  %12llu  %6.3f\n",
+            i * 4, (unsigned long long)c.count, (unsigned long long)c.cycles,
+            (unsigned long long)c.self_cycles, c.self_cycles * 100.0 / total);
+    }
+}
+#endif
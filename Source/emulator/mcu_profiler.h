@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+struct MCU;
+struct mcu_decode_t;
+
+// Execution profile of the firmware, only built with MCU_PROFILER defined
+
+static const int PROFILER_ADDRESS_SPACE = 0x100000; // (cp << 16) | pc
+static const int PROFILER_OPCODES = 512; // operand byte, then general format opcodes
+static const int PROFILER_VECTORS = 64;
+static const int PROFILER_NESTING = 16;
+
+enum {
+    PROFILER_REPORT_TEXT = 0,
+    PROFILER_REPORT_CSV
+};
+
+struct profiler_count_t {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct profiler_vector_t {
+    uint64_t count;
+    uint64_t cycles; // from entry to RTE, including nested exceptions
+    uint64_t self_cycles; // nested exceptions excluded
+};
+
+struct MCU_Profiler {
+    MCU *mcu;
+    MCU_Profiler(MCU *mcu): mcu(mcu) {}
+    ~MCU_Profiler();
+
+    bool enabled = false;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+
+    // allocated by PROFILER_Enable, 16 MB
+    profiler_count_t *address_counts = nullptr;
+    profiler_count_t opcode_counts[PROFILER_OPCODES] = {};
+    profiler_vector_t vector_counts[PROFILER_VECTORS] = {};
+
+    // exceptions that have not returned yet
+    struct {
+        uint8_t vector;
+        uint64_t entry_cycles;
+        uint64_t nested_cycles;
+    } vector_stack[PROFILER_NESTING];
+    int vector_depth = 0;
+
+    void PROFILER_Enable(bool enable);
+    void PROFILER_Reset(void);
+    void PROFILER_Instruction(uint32_t address, const mcu_decode_t *decode, uint32_t cycles);
+    void PROFILER_EnterVector(uint32_t vector);
+    void PROFILER_ReturnVector(void);
+    void PROFILER_Report(FILE *file, int format, int max_addresses);
+};
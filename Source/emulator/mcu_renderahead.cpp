@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "mcu.h"
+#include "mcu_renderahead.h"
+
+MCU_RenderAhead::~MCU_RenderAhead()
+{
+    RENDERAHEAD_Stop();
+}
+
+// Prepares the output path for chunks and starts the worker. The latency
+// is raised to what blocks of up to max_block frames need, returns the
+// one used.
+int MCU_RenderAhead::RENDERAHEAD_Start(int sample_rate, int max_block, int latency)
+{
+    RENDERAHEAD_Stop();
+
+    max_block = std::max(max_block, 1);
+    chunk = std::min(max_block, RENDERAHEAD_MAX_CHUNK);
+    this->sample_rate = sample_rate;
+    this->latency = std::min(std::max(latency, max_block + chunk), RENDERAHEAD_FIFO_SIZE - chunk);
+    mcu->MCU_PrepareOutput(sample_rate, chunk);
+
+    memset(fifo_l, 0, sizeof(fifo_l));
+    memset(fifo_r, 0, sizeof(fifo_r));
+    read_pos = 0;
+    midi_head = 0;
+    midi_done = 0;
+    fifo_written = this->latency;
+    fifo_read = 0;
+    midi_written = 0;
+    midi_read = 0;
+    underruns = 0;
+    midi_dropped = 0;
+    control_done = 0;
+    control_written = 0;
+    control_read = 0;
+    pauses = 0;
+    parked = 0;
+
+    quit = false;
+    worker = std::thread(&MCU_RenderAhead::RENDERAHEAD_Run, this);
+    running = true;
+    return this->latency;
+}
+
+// Events the worker hasn't got to go to the MCU right away, so that no
+// note is left hanging
+void MCU_RenderAhead::RENDERAHEAD_Stop(void)
+{
+    if (!running)
+        return;
+    quit = true;
+    RENDERAHEAD_Wake();
+    // and out of a pause if one is held, two keep it odd
+    pauses.fetch_add(2);
+    pauses.notify_one();
+    worker.join();
+    running = false;
+
+    for (; midi_done != midi_head; midi_done++)
+    {
+        const renderahead_midi_t &e = midi[midi_done & (RENDERAHEAD_MIDI_SIZE - 1)];
+        mcu->postMidiSC55(e.data, e.length);
+    }
+    RENDERAHEAD_DispatchControl();
+}
+
+// frame is relative to the block the next Read returns
+bool MCU_RenderAhead::RENDERAHEAD_PostMidi(const uint8_t *message, int length, int frame)
+{
+    if (length > (int)sizeof(midi[0].data)
+        || midi_head - midi_read.load(std::memory_order_acquire) == RENDERAHEAD_MIDI_SIZE)
+    {
+        midi_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    renderahead_midi_t &e = midi[midi_head & (RENDERAHEAD_MIDI_SIZE - 1)];
+    memcpy(e.data, message, length);
+    e.length = length;
+    e.frame = read_pos + frame;
+    midi_written.store(++midi_head, std::memory_order_release);
+    return true;
+}
+
+// With wait set, for offline renders, blocks until the worker has the
+// frames instead of outputting silence. The worker stops more than
+// latency - chunk frames ahead of the last read, so a longer block is
+// waited for in pieces, each read letting it render the next.
+void MCU_RenderAhead::RENDERAHEAD_Read(float *out_l, float *out_r, int frames, bool wait)
+{
+    int piece = wait ? latency - chunk : frames;
+    for (int i = 0; i < frames; i += piece)
+        RENDERAHEAD_ReadPiece(out_l + i, out_r + i, std::min(piece, frames - i), wait);
+}
+
+void MCU_RenderAhead::RENDERAHEAD_ReadPiece(float *out_l, float *out_r, int frames, bool wait)
+{
+    uint64_t written = fifo_written.load(std::memory_order_acquire);
+    while (wait && written < read_pos + frames)
+    {
+        std::this_thread::yield();
+        written = fifo_written.load(std::memory_order_acquire);
+    }
+
+    int avail = written > read_pos ? (int)std::min<uint64_t>(written - read_pos, frames) : 0;
+    for (int i = 0; i < avail; )
+    {
+        int pos = (int)((read_pos + i) & (RENDERAHEAD_FIFO_SIZE - 1));
+        int n = std::min(avail - i, RENDERAHEAD_FIFO_SIZE - pos);
+        memcpy(out_l + i, fifo_l + pos, n * sizeof(float));
+        memcpy(out_r + i, fifo_r + pos, n * sizeof(float));
+        i += n;
+    }
+    if (avail < frames)
+    {
+        memset(out_l + avail, 0, (frames - avail) * sizeof(float));
+        memset(out_r + avail, 0, (frames - avail) * sizeof(float));
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    read_pos += frames;
+    fifo_read.store(read_pos, std::memory_order_release);
+    RENDERAHEAD_Wake();
+}
+
+// A futex wake on Linux, WakeByAddress on Windows, ulock on macOS; none of
+// them takes a lock, and they return at once when nobody is waiting
+void MCU_RenderAhead::RENDERAHEAD_Wake(void)
+{
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+}
+
+// A full queue, the worker stuck or the message too long for it, falls
+// back to a pause
+void MCU_RenderAhead::RENDERAHEAD_PostControl(const uint8_t *message, int length)
+{
+    uint32_t head = control_written.load(std::memory_order_relaxed);
+    if (!running || length > (int)sizeof(control[0].data)
+        || head - control_read.load(std::memory_order_acquire) == RENDERAHEAD_CONTROL_SIZE)
+    {
+        RENDERAHEAD_Pause();
+        mcu->postMidiSC55(message, length);
+        RENDERAHEAD_Resume();
+        return;
+    }
+
+    renderahead_midi_t &e = control[head & (RENDERAHEAD_CONTROL_SIZE - 1)];
+    memcpy(e.data, message, length);
+    e.length = length;
+    control_written.store(head + 1, std::memory_order_release);
+    RENDERAHEAD_Wake();
+}
+
+void MCU_RenderAhead::RENDERAHEAD_Pause(void)
+{
+    if (!running)
+        return;
+    uint32_t pause = pauses.fetch_add(1) + 1;
+    RENDERAHEAD_Wake();
+    for (uint32_t p = parked.load(std::memory_order_acquire); p != pause; p = parked.load(std::memory_order_acquire))
+        parked.wait(p, std::memory_order_acquire);
+}
+
+void MCU_RenderAhead::RENDERAHEAD_Resume(void)
+{
+    if (!running)
+        return;
+    pauses.fetch_add(1, std::memory_order_release);
+    pauses.notify_one();
+}
+
+void MCU_RenderAhead::RENDERAHEAD_DispatchControl(void)
+{
+    uint32_t head = control_written.load(std::memory_order_acquire);
+    for (; control_done != head; control_done++)
+    {
+        const renderahead_midi_t &e = control[control_done & (RENDERAHEAD_CONTROL_SIZE - 1)];
+        mcu->postMidiSC55(e.data, e.length);
+    }
+    control_read.store(control_done, std::memory_order_release);
+}
+
+// Hands the events due before the end of the chunk at start to the MCU
+void MCU_RenderAhead::RENDERAHEAD_DispatchMidi(uint64_t start)
+{
+    uint32_t head = midi_written.load(std::memory_order_acquire);
+    int src_rate = mcu->MCU_GetSampleRate();
+
+    for (; midi_done != head; midi_done++)
+    {
+        const renderahead_midi_t &e = midi[midi_done & (RENDERAHEAD_MIDI_SIZE - 1)];
+        if (e.frame >= start + chunk)
+            break;
+        // late ones, after an underrun, at the start
+        int samplePos = e.frame > start ? (int)((double)(e.frame - start) / sample_rate * src_rate) : 0;
+        mcu->enqueueMidiSC55(e.data, e.length, samplePos);
+    }
+    midi_read.store(midi_done, std::memory_order_release);
+}
+
+// As high as the system lets a process go without privileges, like the
+// host's audio threads: time critical on Windows, the interactive QoS
+// class on macOS, round robin where the rtprio limit allows it elsewhere.
+// If that fails the worker keeps the default priority and the latency has
+// to cover for it.
+void MCU_RenderAhead::RENDERAHEAD_RaisePriority(void)
+{
+#if defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#else
+    sched_param param = {};
+    param.sched_priority = sched_get_priority_min(SCHED_RR);
+    pthread_setschedparam(pthread_self(), SCHED_RR, &param);
+#endif
+}
+
+void MCU_RenderAhead::RENDERAHEAD_Run(void)
+{
+    uint64_t written = fifo_written.load();
+
+    RENDERAHEAD_RaisePriority();
+
+    for (;;)
+    {
+        // loaded before what it guards, a wake after this makes wait()
+        // return at once
+        uint32_t wakeup = wakeups.load(std::memory_order_acquire);
+        if (quit)
+            return;
+
+        uint32_t pause = pauses.load(std::memory_order_acquire);
+        if (pause & 1)
+        {
+            parked.store(pause, std::memory_order_release);
+            parked.notify_one();
+            pauses.wait(pause, std::memory_order_acquire);
+            continue;
+        }
+        RENDERAHEAD_DispatchControl();
+
+        // the MIDI posted before a block is visible once its read is
+        uint64_t read = fifo_read.load(std::memory_order_acquire);
+        if (written < read)
+            written = read; // the audio thread ran dry, catch up
+
+        // written can fall behind fifo_read while the worker sleeps, if the
+        // host reads a block longer than the latency
+        if (read + latency < written + chunk)
+        {
+            wakeups.wait(wakeup, std::memory_order_acquire);
+            continue;
+        }
+
+        RENDERAHEAD_DispatchMidi(written - latency);
+        mcu->updateSC55WithSampleRate(chunk_l, chunk_r, chunk, sample_rate);
+
+        int pos = (int)(written & (RENDERAHEAD_FIFO_SIZE - 1));
+        int n = std::min(chunk, RENDERAHEAD_FIFO_SIZE - pos);
+        memcpy(fifo_l + pos, chunk_l, n * sizeof(float));
+        memcpy(fifo_r + pos, chunk_r, n * sizeof(float));
+        memcpy(fifo_l, chunk_l + n, (chunk - n) * sizeof(float));
+        memcpy(fifo_r, chunk_r + n, (chunk - n) * sizeof(float));
+
+        written += chunk;
+        fifo_written.store(written, std::memory_order_release);
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+struct MCU;
+
+// Optional worker thread that runs the whole emulator ahead of the host.
+// It renders output frames at the host rate into a FIFO, the audio thread
+// only copies them out and passes MIDI on through a second FIFO.
+//
+// Both FIFOs count frames on one timeline. The output FIFO starts with
+// latency frames of silence, and the worker only renders a chunk once the
+// audio thread has read past its end, so a MIDI event posted for frame
+// read_pos + n is always still ahead of the worker and sounds exactly
+// latency frames later. If the audio thread finds the FIFO short it
+// outputs silence for the rest and the worker skips ahead, latency stays
+// the same.
+//
+// While it runs the worker owns the MCU. The message thread sends MIDI
+// through a queue of its own, and pauses the worker for anything else.
+
+static const int RENDERAHEAD_FIFO_SIZE = 16384; // output frames, power of two
+static const int RENDERAHEAD_MIDI_SIZE = 1024; // events, power of two
+static const int RENDERAHEAD_MAX_CHUNK = 256; // frames rendered at once
+static const int RENDERAHEAD_CONTROL_SIZE = 64; // message thread events, power of two
+
+struct renderahead_midi_t {
+    uint8_t data[32];
+    int length;
+    uint64_t frame; // on the output timeline
+};
+
+struct MCU_RenderAhead {
+    MCU *mcu;
+    MCU_RenderAhead(MCU *mcu): mcu(mcu) {}
+    ~MCU_RenderAhead();
+
+    bool running = false;
+    int sample_rate = 0;
+    int latency = 0; // frames
+    int chunk = 0;
+
+    float fifo_l[RENDERAHEAD_FIFO_SIZE];
+    float fifo_r[RENDERAHEAD_FIFO_SIZE];
+    float chunk_l[RENDERAHEAD_MAX_CHUNK];
+    float chunk_r[RENDERAHEAD_MAX_CHUNK];
+    renderahead_midi_t midi[RENDERAHEAD_MIDI_SIZE];
+    renderahead_midi_t control[RENDERAHEAD_CONTROL_SIZE]; // frame unused
+    uint64_t read_pos = 0; // audio thread copy of fifo_read
+    uint32_t midi_head = 0; // audio thread copy of midi_written
+    uint32_t midi_done = 0; // worker copy of midi_read
+    uint32_t control_done = 0; // worker copy of control_read
+
+    // on lines of their own, each is written by one thread only
+    alignas(64) std::atomic<uint64_t> fifo_written{0};
+    alignas(64) std::atomic<uint64_t> fifo_read{0};
+    alignas(64) std::atomic<uint32_t> midi_written{0};
+    alignas(64) std::atomic<uint32_t> midi_read{0};
+    alignas(64) std::atomic<uint32_t> underruns{0}; // blocks the worker wasn't ready for
+    alignas(64) std::atomic<uint32_t> control_written{0};
+    alignas(64) std::atomic<uint32_t> control_read{0};
+    // odd while the message thread holds a pause, the worker stores the
+    // value it parked for in parked
+    std::atomic<uint32_t> pauses{0};
+    std::atomic<uint32_t> parked{0};
+    std::atomic<uint32_t> midi_dropped{0}; // full queue or too long
+    std::atomic<bool> quit{false};
+    // bumped after each change the worker may be waiting for, it sleeps in
+    // wait() on it so that the audio thread wakes it without a lock
+    std::atomic<uint32_t> wakeups{0};
+    std::thread worker;
+
+    // not to be called while a block is rendered
+    int RENDERAHEAD_Start(int sample_rate, int max_block, int latency);
+    void RENDERAHEAD_Stop(void);
+
+    // audio thread, the MIDI of a block before its Read
+    bool RENDERAHEAD_PostMidi(const uint8_t *message, int length, int frame);
+    void RENDERAHEAD_Read(float *out_l, float *out_r, int frames, bool wait);
+    void RENDERAHEAD_ReadPiece(float *out_l, float *out_r, int frames, bool wait);
+
+    // message thread. PostControl passes MIDI on to the MCU as soon as the
+    // worker gets to it, Pause returns once the worker is parked between
+    // chunks and leaves the MCU to the caller until Resume. Without the
+    // worker they post directly and do nothing.
+    void RENDERAHEAD_PostControl(const uint8_t *message, int length);
+    void RENDERAHEAD_Pause(void);
+    void RENDERAHEAD_Resume(void);
+
+    void RENDERAHEAD_Wake(void);
+    void RENDERAHEAD_DispatchMidi(uint64_t start);
+    void RENDERAHEAD_DispatchControl(void);
+    void RENDERAHEAD_RaisePriority(void);
+    void RENDERAHEAD_Run(void);
+};
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <numeric>
+#include "mcu_resampler.h"
+#include "pcm_lanes.h"
+
+MCU_Resampler::~MCU_Resampler()
+{
+    RESAMPLER_Close();
+}
+
+static double kaiser_i0(double x)
+{
+    double sum = 1.0, u = 1.0, halfx = x / 2.0;
+    for (int n = 1; u >= 1e-21 * sum; n++)
+    {
+        double t = halfx / n;
+        u *= t * t;
+        sum += u;
+    }
+    return sum;
+}
+
+static const struct {
+    double crossings;
+    double beta;
+    double rolloff;
+} resampler_filters[] = {
+    { 5.0, 6.0, 0.90 },
+    { 17.0, 6.0, 0.90 },
+    { 32.0, 9.0, 0.95 },
+};
+
+// Returns false if the ratio needs too many phases or taps, the caller
+// falls back to libresample then. Allocates, not for the audio thread.
+bool MCU_Resampler::RESAMPLER_Open(int src_rate, int dst_rate, int max_block, int quality)
+{
+    RESAMPLER_Close();
+
+    this->src_rate = src_rate;
+    this->dst_rate = dst_rate;
+    this->quality = quality;
+    this->max_block = max_block;
+
+    if (src_rate <= 0 || dst_rate <= 0)
+        return false;
+
+    int g = std::gcd(src_rate, dst_rate);
+    int l = dst_rate / g;
+    int m = src_rate / g;
+
+    const double pi = 3.14159265358979323846;
+    quality = std::clamp(quality, (int)RESAMPLER_QUALITY_DRAFT, (int)RESAMPLER_QUALITY_MASTERING);
+    const double rolloff = resampler_filters[quality].rolloff;
+    const double beta = resampler_filters[quality].beta;
+    const double crossings = resampler_filters[quality].crossings;
+    double scale = std::min(1.0, (double)dst_rate / src_rate);
+    double halflen = crossings / scale; // in source samples
+    int t = ((int)ceil(halflen) * 2 + 7) & ~7;
+
+    if (l > RESAMPLER_MAX_PHASES || t > RESAMPLER_MAX_TAPS)
+        return false;
+
+    table = (float *)calloc(l * t, sizeof(float));
+    buffer_size = max_block * 2 + t;
+    buffer = (float *)calloc(buffer_size * 2, sizeof(float));
+    if (!table || !buffer)
+    {
+        RESAMPLER_Close();
+        return false;
+    }
+
+    // output p of a run sits p / l source samples after tap t / 2 - 1
+    double ibeta = 1.0 / kaiser_i0(beta);
+    for (int p = 0; p < l; p++)
+    {
+        float *h = &table[p * t];
+        double sum = 0.0;
+        for (int j = 0; j < t; j++)
+        {
+            double x = (j - t / 2 + 1 - (double)p / l) * scale;
+            double r = x / crossings;
+            double c = 0.0;
+            if (r > -1.0 && r < 1.0)
+            {
+                c = x == 0.0 ? rolloff : sin(pi * rolloff * x) / (pi * x);
+                c *= kaiser_i0(beta * sqrt(1.0 - r * r)) * ibeta;
+            }
+            h[j] = (float)c;
+            sum += c;
+        }
+        // unity gain at DC for every phase
+        for (int j = 0; j < t; j++)
+            h[j] = (float)(h[j] / sum);
+    }
+
+    phases = l;
+    step = m;
+    taps = t;
+    RESAMPLER_Reset();
+    return true;
+}
+
+// Drops the source samples kept from earlier calls, doesn't allocate
+void MCU_Resampler::RESAMPLER_Reset(void)
+{
+    buffer_frames = taps / 2 - 1; // silence before the first sample
+    if (buffer)
+        memset(buffer, 0, buffer_frames * 2 * sizeof(float));
+    phase = 0;
+}
+
+void MCU_Resampler::RESAMPLER_Close(void)
+{
+    free(table);
+    free(buffer);
+    table = nullptr;
+    buffer = nullptr;
+    phases = 0;
+}
+
+// Filters one output frame, both channels, from taps frames at x
+static inline void resampler_dot(const float *h, const float *x, int taps, float *l, float *r)
+{
+#if defined(PCM_LANES_AVX2)
+    const __m256i lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int j = 0; j < taps; j += 8)
+    {
+        __m256 c = _mm256_loadu_ps(h + j);
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(x + j * 2), _mm256_permutevar8x32_ps(c, lo)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(x + j * 2 + 8), _mm256_permutevar8x32_ps(c, hi)));
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    *l = _mm_cvtss_f32(s);
+    *r = _mm_cvtss_f32(_mm_shuffle_ps(s, s, 1));
+#elif defined(PCM_LANES_SSE2)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (int j = 0; j < taps; j += 4)
+    {
+        __m128 c = _mm_loadu_ps(h + j);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + j * 2), _mm_unpacklo_ps(c, c)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + j * 2 + 4), _mm_unpackhi_ps(c, c)));
+    }
+    __m128 s = _mm_add_ps(acc0, acc1);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    *l = _mm_cvtss_f32(s);
+    *r = _mm_cvtss_f32(_mm_shuffle_ps(s, s, 1));
+#else
+    float sl = 0.0f, sr = 0.0f;
+    for (int j = 0; j < taps; j++)
+    {
+        sl += h[j] * x[j * 2];
+        sr += h[j] * x[j * 2 + 1];
+    }
+    *l = sl;
+    *r = sr;
+#endif
+}
+
+// Takes count stereo samples as rendered by the PCM, writes up to max_out
+// frames and returns how many. Source samples that aren't used yet are
+// kept for the next call.
+int MCU_Resampler::RESAMPLER_Process(const int32_t (*in)[2], int count, float *out_l, float *out_r, int max_out)
+{
+    if (buffer_frames + count > buffer_size)
+    {
+        // the output fell far behind, drop the oldest samples
+        int drop = std::min(buffer_frames + count - buffer_size, buffer_frames);
+        memmove(buffer, buffer + drop * 2, (buffer_frames - drop) * 2 * sizeof(float));
+        buffer_frames -= drop;
+        count = std::min(count, buffer_size - buffer_frames);
+    }
+
+    const float scale = 1.0f / 2147483648.0f;
+    float *dst = buffer + buffer_frames * 2;
+    for (int i = 0; i < count; i++)
+    {
+        dst[i * 2] = in[i][0] * scale;
+        dst[i * 2 + 1] = in[i][1] * scale;
+    }
+    buffer_frames += count;
+
+    int pos = 0;
+    int n = 0;
+    while (n < max_out && pos + taps <= buffer_frames)
+    {
+        resampler_dot(&table[phase * taps], &buffer[pos * 2], taps, &out_l[n], &out_r[n]);
+        n++;
+        phase += step;
+        pos += phase / phases;
+        phase %= phases;
+    }
+
+    pos = std::min(pos, buffer_frames);
+    memmove(buffer, buffer + pos * 2, (buffer_frames - pos) * 2 * sizeof(float));
+    buffer_frames -= pos;
+    return n;
+}
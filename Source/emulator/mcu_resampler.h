@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#include <stdint.h>
+
+// Polyphase resampler for the output of the PCM, for rates that are a
+// small rational multiple of the source rate (64 or 32 kHz to 44.1, 48,
+// 88.2 or 96 kHz and the like). The filter is a Kaiser windowed sinc, see
+// RESAMPLER_QUALITY_*. Its taps are precomputed for every phase, so there
+// is no coefficient interpolation per output sample, and both channels are
+// filtered in one pass over the interleaved samples.
+
+static const int RESAMPLER_MAX_PHASES = 512;
+static const int RESAMPLER_MAX_TAPS = 256;
+
+enum {
+    RESAMPLER_QUALITY_DRAFT = 0, // 5 zero crossings a side, libresample without highQuality
+    RESAMPLER_QUALITY_NORMAL, // 17, libresample with highQuality
+    RESAMPLER_QUALITY_MASTERING // 32, wider passband and deeper stopband
+};
+
+struct MCU_Resampler {
+    ~MCU_Resampler();
+
+    // as last opened, also when that failed
+    int src_rate = 0;
+    int dst_rate = 0;
+    int quality = -1;
+    int max_block = 0; // source samples per RESAMPLER_Process call
+
+    int phases = 0; // L, 0 while closed
+    int step = 0; // M, source samples per L output samples
+    int taps = 0; // per phase, a multiple of 8
+
+    float *table = nullptr; // [phases][taps]
+    float *buffer = nullptr; // interleaved source samples, the unread ones first
+    int buffer_size = 0; // frames
+    int buffer_frames = 0;
+    int phase = 0;
+
+    bool RESAMPLER_Open(int src_rate, int dst_rate, int max_block, int quality);
+    void RESAMPLER_Close(void);
+    void RESAMPLER_Reset(void);
+    int RESAMPLER_Process(const int32_t (*in)[2], int count, float *out_l, float *out_r, int max_out);
+};
@@ -33,6 +33,7 @@
  */
 #include <stdint.h>
 #include <string.h>
+#include <algorithm>
 #include "mcu.h"
 #include "mcu_timer.h"
 
@@ -62,6 +63,8 @@ void MCU_Timer::TIMER_Reset(void)
     timer0_ociea = false;
     timer1_ociea = false;
     timer2_ociea = false;
+    timer_cycles = mcu->mcu.cycles;
+    timer_idle_mask = 0;
 }
 
 void MCU_Timer::TIMER_Write(uint32_t address, uint8_t data)
@@ -176,7 +179,10 @@ uint8_t MCU_Timer::TIMER_Read2(uint32_t address)
 
 void MCU_Timer::TIMER_Clock(uint64_t cycles)
 {
-    if (timer8_enabled && (cycles & 0x3f) == 0)
+    // the FRCs advance once every 2 cycles
+    uint16_t ticks = (cycles - timer_cycles) >> 1;
+
+    if (timer8_enabled && cycles / TIMER8_PERIOD != timer_cycles / TIMER8_PERIOD)
     {
         timer8_cmfa = true;
         if (timer8_cmiea)
@@ -188,7 +194,7 @@ void MCU_Timer::TIMER_Clock(uint64_t cycles)
         if (matcha)
             timer0_frc = 0;
         else
-            timer0_frc += 6;
+            timer0_frc += ticks;
 
         if (matcha)
             timer0_ocfa |= 0x20;
@@ -200,7 +206,7 @@ void MCU_Timer::TIMER_Clock(uint64_t cycles)
         if (matcha)
             timer1_frc = 0;
         else
-            timer1_frc += 6;
+            timer1_frc += ticks;
 
         if (matcha)
             timer1_ocfa |= 0x20;
@@ -212,11 +218,80 @@ void MCU_Timer::TIMER_Clock(uint64_t cycles)
         if (matcha)
             timer2_frc = 0;
         else
-            timer2_frc += 6;
+            timer2_frc += ticks;
 
         if (matcha)
             timer2_ocfa |= 0x20;
         if (timer2_ociea && matcha)
             MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_FRT2_OCIA, 1);
     }
+
+    timer_cycles = cycles;
+}
+
+// Earliest cycle count from which the FRC compares as matched. The clock
+// that gets there only advances the counter, the next one sees the match.
+static uint64_t TIMER_FRTMatchCycles(uint64_t cycles, uint16_t frc, uint16_t ocra)
+{
+    uint32_t target = ocra << 2;
+    if (target > 0xffff)
+        return UINT64_MAX; // frc >> 2 never reaches ocra
+    if (frc >= target)
+        return cycles;
+    return cycles + 2 * (target - frc);
+}
+
+// An FRT with OCRA = 0 matches on every clock. Once its flag and interrupt
+// request are set, these matches don't change anything.
+static bool TIMER_FRTIdle(uint16_t frc, uint16_t ocra, bool ocfa, bool ociea, uint8_t pending)
+{
+    return ocra == 0 && frc == 0 && ocfa && (!ociea || pending);
+}
+
+// Earliest cycle count at which TIMER_Clock can change anything apart from
+// the counters. Only valid until the next timer register access.
+uint64_t MCU_Timer::TIMER_NextEvent(void)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    timer_idle_mask = 0;
+    if (TIMER_FRTIdle(timer0_frc, timer0_ocra, timer0_ocfa, timer0_ociea,
+        (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_FRT0_OCIA)) != 0))
+        timer_idle_mask |= 1;
+    else
+        deadline = std::min(deadline, TIMER_FRTMatchCycles(timer_cycles, timer0_frc, timer0_ocra));
+    if (TIMER_FRTIdle(timer1_frc, timer1_ocra, timer1_ocfa, timer1_ociea,
+        (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_FRT1_OCIA)) != 0))
+        timer_idle_mask |= 2;
+    else
+        deadline = std::min(deadline, TIMER_FRTMatchCycles(timer_cycles, timer1_frc, timer1_ocra));
+    if (TIMER_FRTIdle(timer2_frc, timer2_ocra, timer2_ocfa, timer2_ociea,
+        (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_FRT2_OCIA)) != 0))
+        timer_idle_mask |= 4;
+    else
+        deadline = std::min(deadline, TIMER_FRTMatchCycles(timer_cycles, timer2_frc, timer2_ocra));
+    if (!TIMER_Timer8Idle())
+        deadline = std::min(deadline, (timer_cycles / TIMER8_PERIOD + 1) * TIMER8_PERIOD);
+    return deadline;
+}
+
+// Same as clocking the timers up to the given cycle count, only valid below
+// TIMER_NextEvent()
+void MCU_Timer::TIMER_Advance(uint64_t cycles)
+{
+    uint16_t ticks = (cycles - timer_cycles) >> 1;
+    if (!(timer_idle_mask & 1))
+        timer0_frc += ticks;
+    if (!(timer_idle_mask & 2))
+        timer1_frc += ticks;
+    if (!(timer_idle_mask & 4))
+        timer2_frc += ticks;
+    timer_cycles = cycles;
+}
+
+// True if 8-bit timer ticks can't change anything
+bool MCU_Timer::TIMER_Timer8Idle(void)
+{
+    return !timer8_enabled || (timer8_cmfa
+        && (!timer8_cmiea || (mcu->mcu.interrupt_pending & (1 << INTERRUPT_SOURCE_TIMER_CMIA)) != 0));
 }
@@ -36,6 +36,10 @@
 
 struct MCU;
 
+// The 8-bit timer compare match is not derived from TCORA, it fires once
+// every TIMER8_PERIOD cycles
+static const uint64_t TIMER8_PERIOD = 192;
+
 struct MCU_Timer {
     MCU *mcu;
     MCU_Timer(MCU *mcu): mcu(mcu) {}
@@ -65,10 +69,16 @@ struct MCU_Timer {
     bool timer1_ociea;
     bool timer2_ociea;
 
+    uint64_t timer_cycles; // cycle count of the last clock
+    uint8_t timer_idle_mask; // FRTs left alone by TIMER_Advance
+
     void TIMER_Reset(void);
     void TIMER_Write(uint32_t address, uint8_t data);
     uint8_t TIMER_Read(uint32_t address);
     void TIMER_Clock(uint64_t cycles);
+    uint64_t TIMER_NextEvent(void);
+    void TIMER_Advance(uint64_t cycles);
+    bool TIMER_Timer8Idle(void);
 
     void TIMER2_Write(uint32_t address, uint8_t data);
     uint8_t TIMER_Read2(uint32_t address);
@@ -34,32 +34,39 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
+#include <bit>
+#include <array>
 #include "mcu.h"
 #include "mcu_interrupt.h"
 #include "pcm.h"
+#include "pcm_lanes.h"
 
-Pcm::Pcm(MCU *mcu): mcu(mcu) {}
+// Reads from the unmapped bank 7
+static const uint8_t waverom_none[PCM_WAVEROM_BANK_SIZE] = {0};
+
+Pcm::Pcm(MCU *mcu): mcu(mcu)
+{
+    waverom_banks[0] = waverom1;
+    waverom_banks[1] = waverom2;
+    waverom_banks[2] = waverom_card;
+    waverom_banks[7] = waverom_none;
+    PCM_SetExpansion(nullptr);
+}
+
+// Maps the four banks of an 8 MB expansion, nullptr for waverom_exp. The
+// data isn't copied and has to outlive its use.
+void Pcm::PCM_SetExpansion(const uint8_t *exp)
+{
+    if (!exp)
+        exp = waverom_exp;
+    for (int i = 0; i < 4; i++)
+        waverom_banks[3 + i] = exp + i * PCM_WAVEROM_BANK_SIZE;
+}
 
 inline uint8_t Pcm::PCM_ReadROM(uint32_t address)
 {
-    int bank = (address >> 21) & 7;
-    switch (bank)
-    {
-        case 0:
-            return waverom1[address & 0x1fffff];
-        case 1:
-            return waverom2[address & 0x1fffff];
-        case 2:
-            return waverom_card[address & 0x1fffff];
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-            return waverom_exp[(address & 0x1fffff) + (bank - 3) * 0x200000];
-        default:
-            break;
-    }
-    return 0;
+    return waverom_banks[(address >> 21) & 7][address & (PCM_WAVEROM_BANK_SIZE - 1)];
 }
 
 void Pcm::PCM_Write(uint32_t address, uint8_t data)
@@ -110,10 +117,13 @@ void Pcm::PCM_Write(uint32_t address, uint8_t data)
     else if (address == 0x3c)
     {
         pcm.config_reg_3c = data;
+        pcm.voice_idle = 0;
     }
     else if (address == 0x3d)
     {
         pcm.config_reg_3d = data;
+        pcm.voice_idle = 0;
+        pcm.effects_quiet = 0;
     }
     else if (address == 0x3e)
     {
@@ -146,7 +156,10 @@ void Pcm::PCM_Write(uint32_t address, uint8_t data)
             if ((address & 4) == 0)
                 ix |= 2;
 
-            pcm.ram1[pcm.select_channel][ix] = pcm.write_latch;
+            pcm.ram1[ix][pcm.select_channel] = pcm.write_latch;
+            pcm.voice_idle &= ~(1u << pcm.select_channel);
+            if (pcm.select_channel >= 28)
+                pcm.effects_quiet = 0;
         }
     }
     else if ((address >= 0x10 && address < 0x20) || (address >= 0x30 && address < 0x38))
@@ -168,13 +181,16 @@ void Pcm::PCM_Write(uint32_t address, uint8_t data)
             if (address & 32)
                 ix |= 8;
 
-            pcm.ram2[pcm.select_channel][ix] = pcm.write_latch;
+            pcm.ram2[ix][pcm.select_channel] = pcm.write_latch;
+            pcm.voice_idle &= ~(1u << pcm.select_channel);
+            if (pcm.select_channel >= 28)
+                pcm.effects_quiet = 0;
         }
     }
 }
 
-// rv: [30][2], [30][3]
-// ch: [31][2], [31][5]
+// rv: [2][30], [3][30]
+// ch: [2][31], [5][31]
 
 uint8_t Pcm::PCM_Read(uint32_t address)
 {
@@ -221,7 +237,7 @@ uint8_t Pcm::PCM_Read(uint32_t address)
             if ((address & 4) == 0)
                 ix |= 2;
 
-            pcm.read_latch = pcm.ram1[pcm.select_channel][ix];
+            pcm.read_latch = pcm.ram1[ix][pcm.select_channel];
         }
     }
     else if ((address >= 0x10 && address < 0x20) || (address >= 0x30 && address < 0x38))
@@ -232,7 +248,7 @@ uint8_t Pcm::PCM_Read(uint32_t address)
             if (address & 32)
                 ix |= 8;
 
-            pcm.read_latch = pcm.ram2[pcm.select_channel][ix];
+            pcm.read_latch = pcm.ram2[ix][pcm.select_channel];
         }
     }
     else if (address >= 0x39 && address <= 0x3b)
@@ -408,1028 +424,1498 @@ inline void calc_tv(pcm_t *pcm, int e, int adjust, uint16_t *levelcur, int activ
     }
 }
 
+// eram words decoded, a 14-bit mantissa with a 2-bit exponent
+static const auto eram_unpack_lut = [] {
+    std::array<int32_t, 0x10000> lut = {};
+    for (int data = 0; data < 0x10000; data++)
+    {
+        int val = data & 0x3fff;
+        int sh = (data >> 14) & 3;
+        lut[data] = (int32_t)((uint32_t)val << 18) >> (18 - sh * 2);
+    }
+    return lut;
+}();
+
 inline int eram_unpack(pcm_t *pcm, int addr, int type = 0)
 {
-    addr &= 0x3fff;
-    int data = pcm->eram[addr];
-    int val = data & 0x3fff;
-    int sh = (data >> 14) & 3;
-
-    val <<= 18;
-    return val >> (18 - sh * 2 + type);
+    int data = pcm->eram[addr & 0x3fff];
+    pcm->eram_heard |= data;
+    return eram_unpack_lut[data] >> type;
 }
 
 inline void eram_pack(pcm_t *pcm, int addr, int val)
 {
     addr &= 0x3fff;
-    int sh = 0;
     int top = (val >> 13) & 0x7f;
-    if (top & 0x40)
-        top ^= 0x7f;
-    if (top >= 16)
-        sh = 3;
-    else if (top >= 4)
-        sh = 2;
-    else if (top >= 1)
-        sh = 1;
-    else
-        sh = 0;
+    top ^= -(top >> 6) & 0x7f; // magnitude
+    int sh = (top >= 1) + (top >= 4) + (top >= 16);
 
     int data = (val >> (sh * 2)) & 0x3fff;
     data |= sh << 14;
     pcm->eram[addr] = data;
+    pcm->eram_heard |= data;
 }
 
-void Pcm::PCM_Update(uint64_t cycles)
+// Adds a slot to the output and reverb/chorus sums, in slot order
+inline void mix_slot(pcm_t *pcm, int slot, int reg_slots, int sampl, int sampr, int rc0, int rc1,
+    const int *rcadd, const int *rcadd2)
 {
-    int reg_slots = (pcm.config_reg_3d & 31) + 1;
-    int voice_active = pcm.voice_mask & pcm.voice_mask_pending;
-    while (pcm.cycles < cycles)
+    // mix reverb/chorus?
+    int slot2 = (slot == reg_slots - 1) ? 31 : slot + 1;
+    switch (slot2)
     {
-        int tt[2] = {};
+        // 17, 18 - reverb
 
-        { // final mixing
-            int noise_mask = 0;
-            int orval = 0;
-            int write_mask = 3;
-            // int dac_mask = -4;
+        case 17:
+            pcm->ram1[1][31] = addclip20(pcm->ram1[1][31], rcadd[0] >> 1, rcadd[0] & 1);
+            break;
+        case 18:
+            pcm->ram1[3][31] = addclip20(pcm->ram1[3][31], rcadd[1] >> 1, rcadd[1] & 1);
+            break;
+        case 21:
+            pcm->ram1[1][31] = addclip20(pcm->ram1[1][31], rcadd[2] >> 1, rcadd[2] & 1);
+            break;
+        case 22:
+            pcm->ram1[3][31] = addclip20(pcm->ram1[3][31], rcadd[3] >> 1, rcadd[3] & 1);
+            break;
+        case 23:
+            pcm->ram1[1][31] = addclip20(pcm->ram1[1][31], rcadd[4] >> 1, rcadd[4] & 1);
+            break;
+        case 31:
+            pcm->ram1[3][31] = addclip20(pcm->ram1[3][31], rcadd[5] >> 1, rcadd[5] & 1);
+            break;
+    }
 
+    int suml = addclip20(pcm->ram1[1][31], sampl >> 6, (sampl >> 5) & 1);
+    int sumr = addclip20(pcm->ram1[3][31], sampr >> 6, (sampr >> 5) & 1);
 
-            int shifter = pcm.ram2[30][10];
-            int xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
-            shifter = (shifter >> 1) | (xr << 15);
-            pcm.ram2[30][10] = shifter;
+    switch (slot2)
+    {
+        case 17:
+            pcm->rcsum[1] = addclip20(pcm->rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
+            break;
+        case 18:
+            pcm->rcsum[1] = addclip20(pcm->rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
+            break;
+        case 21:
+            pcm->rcsum[0] = addclip20(pcm->rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
+            break;
+        case 22:
+            pcm->rcsum[1] = addclip20(pcm->rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
+            break;
+        case 23:
+            pcm->rcsum[0] = addclip20(pcm->rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
+            break;
+        case 31:
+            pcm->rcsum[1] = addclip20(pcm->rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
+            break;
+    }
 
-            pcm.accum_l = addclip20(pcm.accum_l, pcm.ram1[30][0], 0);
-            pcm.accum_r = addclip20(pcm.accum_r, pcm.ram1[30][1], 0);
+    pcm->rcsum[0] = addclip20(pcm->rcsum[0], rc0 >> 1, rc0 & 1);
+    pcm->rcsum[1] = addclip20(pcm->rcsum[1], rc1 >> 1, rc1 & 1);
 
-            pcm.ram1[30][2] = addclip20(pcm.accum_l,
-                orval | (shifter & noise_mask), 0);
+    if (slot != reg_slots - 1)
+    {
+        pcm->ram1[1][31] = suml;
+        pcm->ram1[3][31] = sumr;
+    }
+    else
+    {
+        pcm->accum_l = suml;
+        pcm->accum_r = sumr;
+    }
+}
 
-            pcm.ram1[30][4] = addclip20(pcm.accum_r,
-                orval | (shifter & noise_mask), 0);
+void Pcm::PCM_SlotIRQ(int slot)
+{
+    //printf("irq voice %i\n", slot);
+    if (pcm.nfs)
+        pcm.ram2[8][slot] |= 0x4000;
+    pcm.irq_assert = 1;
+    pcm.irq_channel = slot;
+    if (mcu->mcu_jv880)
+        mcu->MCU_GA_SetGAInt(5, 1);
+    else
+        MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_IRQ0, 1);
+}
 
-            pcm.ram1[30][0] = pcm.accum_l & write_mask;
-            pcm.ram1[30][1] = pcm.accum_r & write_mask;
-            
+// sx20, addclip20 and multi for lanes, conditions are masks (see pcm_lanes.h)
 
-            tt[0] = (int)((pcm.ram1[30][2] & ~write_mask) << 12);
-            tt[1] = (int)((pcm.ram1[30][4] & ~write_mask) << 12);
+template <typename L>
+inline L sx20_lanes(L in)
+{
+    return (in << 12) >> 12;
+}
 
-            mcu->MCU_PostSample(tt);
+template <typename L>
+inline L addclip20_lanes(L add1, L add2, L cin)
+{
+    return sx20_lanes(add1) + sx20_lanes(add2) + cin;
+}
 
-            xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
-            shifter = (shifter >> 1) | (xr << 15);
+template <typename L>
+inline L multi_lanes(L val1, L val2)
+{
+    return mul(sx20_lanes(val1), (val2 << 24) >> 24);
+}
 
-            pcm.accum_l = addclip20(pcm.accum_l, pcm.ram1[30][0], 0);
-            pcm.accum_r = addclip20(pcm.accum_r, pcm.ram1[30][1], 0);
+template <typename L>
+inline L s8_lanes(L in)
+{
+    return (in << 24) >> 24;
+}
 
-            pcm.ram1[30][3] = addclip20(pcm.accum_l,
-                orval | (shifter & noise_mask), 0);
+// calc_tv for lanes, returns the new level and both branches are evaluated
+template <typename L>
+inline L calc_tv_lanes(pcm_t *pcm, int e, L adjust, L levelcur, L active, L *volmul)
+{
+    const L zero = 0;
+    levelcur = levelcur & 0x7fff;
+
+    L speed = adjust & 0xff;
+    L speed_and_0x20 = ~eq(speed & 0x20, zero);
+    L speed_and_0x40 = ~eq(speed & 0x40, zero);
+    L speed_and_0x80 = ~eq(speed & 0x80, zero);
+    L target = (adjust >> 8) & 0xff;
+
+    L w1 = eq(speed & 0xf0, zero);
+    L w2 = w1 | ~eq(speed & 0x10, zero);
+    L w3 = ~speed_and_0x80 | (~speed_and_0x40 & (~w2 | ~speed_and_0x20));
+    L type4 = ~speed_and_0x80 | ~speed_and_0x40;
+
+    // tv_counter is shared by all slots, so addlow and the write condition
+    // only depend on type & 3
+    int addlow_t[4];
+    int write_t[4];
+    for (int t = 0; t < 4; t++)
+    {
+        addlow_t[t] = flip_nibble_lut[(pcm->tv_counter >> (2 * t + 2)) & 0x0f];
+        write_t[t] = (pcm->tv_counter & tvc_lut[t]) ? 0 : -1;
+    }
+    L addlow = select(speed_and_0x20, select(w2, L(addlow_t[3]), L(addlow_t[2])),
+        select(w2, L(addlow_t[1]), L(addlow_t[0])));
+    L write = select(speed_and_0x20, select(w2, L(write_t[3]), L(write_t[2])),
+        select(w2, L(write_t[1]), L(write_t[0])));
+    addlow = select(type4, L(flip_nibble_lut[pcm->tv_counter & 0x0f]), addlow);
+    write = select(type4, L(-1), write) | ~active;
+
+    L level = levelcur << 4;
+    if (e == 2)
+        level = level & active;
+    L sum1 = (target << 11) - level;
+
+    // (type & 8) == 0
+    L shift = (L(10) - (speed & 15)) & 15;
+    L sum2 = (target << 11) + addlow + (sra(sum1, shift) - sum1);
+    L level_linear = (sum2 >> 4) & 0x7fff;
+    L volmul_linear = (sum2 >> 4) & 0x7ffe;
+
+    // (type & 8) != 0
+    shift = (L(10) - (((speed >> 4) & 14) | (w2 & 1))) & 15;
+    L neg = ~eq(sum1 & 0x80000, zero);
+    L preshift = ((speed & 15) << 9) | (~w1 & 0x2000);
+    preshift = preshift ^ (neg & ~0x3f);
+    L add = levelcur << 4 | addlow;
+    if (e == 2)
+        add = add & active;
+    L sum2_l = (sra(preshift, shift) + add) >> 4;
+    L sum3 = (target << 11) - (sum2_l << 4);
+    L neg2 = ~eq(sum3 & 0x80000, zero);
+    L xnor = ~(neg2 ^ neg);
+    L level_exp = select(xnor, sum2_l & 0x7fff, target << 7);
+    L volmul_exp = sum2_l & 0x7ffe;
+    if (e == 1)
+        volmul_exp = select(xnor, volmul_exp, target << 7);
+
+    if (volmul)
+        *volmul = select(w3, volmul_exp, volmul_linear);
+    return select(write, select(w3, level_exp, level_linear), levelcur);
+}
 
-            pcm.ram1[30][5] = addclip20(pcm.accum_r,
-                orval | (shifter & noise_mask), 0);
+// An idle slot is keyed off and has gone through a whole frame with nfs
+// set: the address generator, filter and the first two envelopes write
+// back what they read, and its output is 0. Only the filter envelope
+// still moves.
+void Pcm::PCM_UpdateIdle(int slot, pcm_slot_mix_t *mix)
+{
+    calc_tv(&pcm, 2, pcm.ram2[5][slot], &pcm.ram2[11][slot], 0, NULL);
+    mix->sampl[slot] = 0;
+    mix->sampr[slot] = 0;
+    mix->rc0[slot] = 0;
+    mix->rc1[slot] = 0;
+    mix->irq[slot] = 0;
+}
 
-            // if (pcm.config_reg_3c & 0x40) // oversampling
-            if (true) // oversampling
-            // if (false) // oversampling
-            {
-                pcm.ram2[30][10] = shifter;
+// The slot loop of PCM_Update for L::width slots starting at slot. Mixing
+// and the IRQ are left to the caller as they depend on the slot order.
+template <typename L>
+void Pcm::PCM_UpdateLanes(int slot, int voice_active, pcm_slot_mix_t *mix)
+{
+    const L zero = 0;
+    const int width = L::width;
+
+    L ram2_7 = L::load(&pcm.ram2[7][slot]);
+    L ram2_8 = L::load(&pcm.ram2[8][slot]);
+    L okey = ~eq(ram2_7 & 0x20, zero);
+    L key = eq(L(voice_active >> slot) & L::bits(), L::bits());
+
+    L active = okey & key;
+    L kon = key & ~okey;
+
+    // address generator
+
+    L b15 = ~eq(ram2_8 & 0x8000, zero);
+    L b6 = ~eq(ram2_7 & 0x40, zero);
+    L b7 = ~eq(ram2_7 & 0x80, zero);
+    L hiaddr = ((ram2_7 >> 8) & 15) << 20;
+    L old_nibble = (ram2_7 >> 12) & 15;
+
+    L address = L::load(&pcm.ram1[4][slot]);
+    L address_end = L::load(&pcm.ram1[0][slot]);
+    L address_loop = L::load(&pcm.ram1[2][slot]);
+
+    L cmp1 = select(b15, address_loop, address_end);
+    L nibble_cmp1 = eq(cmp1 & 0xffff0, address & 0xffff0);
+
+    L irq_flag = select(kon, ~eq((cmp1 + address_loop) & 0x100000, zero),
+        ~eq((address + ((zero - address_loop) & 0xfffff)) & 0x100000, zero));
+    irq_flag = irq_flag ^ b7;
+
+    L nibble_address = select(~b6 & nibble_cmp1, address_loop, address);
+    L address_b4 = ~eq(nibble_address & 0x10, zero);
+    L wave_address = nibble_address >> 5;
+    L xor2 = address_b4 ^ b7;
+    L check1 = xor2 & active;
+    L xor1 = b15 ^ ~nibble_cmp1;
+    L nibble_add = select(b6, check1 & xor1, ~nibble_cmp1 & check1);
+    L nibble_subtract = b6 & ~xor1 & active & ~xor2;
+    L nibble_step = nibble_subtract - nibble_add; // masks are -1
+    wave_address = (wave_address + select(b7, zero - nibble_step, nibble_step)) & 0xfffff;
+
+    L newnibble_sel = address_b4 ^ ((b6 | ~nibble_cmp1) & okey);
+
+    L sub_phase = ram2_8 & 0x3fff;
+    L interp_ratio = (sub_phase >> 7) & 127;
+    sub_phase = sub_phase + gather(pcm.ram2[0], ram2_7 & 31);
+    L sub_phase_of = (sub_phase >> 14) & 7;
+    if (pcm.nfs)
+        ram2_8 = (ram2_8 & ~0x3fff) | (sub_phase & 0x3fff);
+
+    L address_cnt = address;
+    auto advance = [&]() {
+        L address_cmp = eq(select(b15, address_loop, address_end) & 0xfffff, address_cnt & 0xfffff);
+        L address_cnt2 = select(~b6 & address_cmp, address_loop, address_cnt);
+        L address_add = ~address_cmp & select(b6, ~b15, L(-1));
+        L address_sub = ~address_cmp & b6 & b15;
+        L address_step = address_sub - address_add;
+        address_cnt = (address_cnt2 + select(b7, zero - address_step, address_step)) & 0xfffff;
+        b15 = b6 & (b15 ^ address_cmp);
+    };
+
+    // address 0, address_cnt == address so nibble_cmp2 is always set
+    L samp_address[4];
+    L nibble_cmp[4];
+    samp_address[0] = hiaddr | address_cnt;
+    nibble_cmp[0] = L(-1);
+    L next_address = address_cnt;
+    L usenew = zero;
+    L next_b15 = b15;
+
+    for (int i = 1; i < 4; i++)
+    {
+        advance();
+        samp_address[i] = hiaddr | address_cnt;
+        nibble_cmp[i] = eq(address & 0xffff0, address_cnt & 0xffff0);
+        L of = gt(sub_phase_of, L(i - 1));
+        next_address = select(of, address_cnt, next_address);
+        usenew = select(of, ~nibble_cmp[i], usenew);
+        next_b15 = select(of, b15, next_b15);
+    }
 
-                pcm.ram1[30][0] = pcm.accum_l & write_mask;
-                pcm.ram1[30][1] = pcm.accum_r & write_mask;
+    advance();
+    L of4 = gt(sub_phase_of, L(3));
+    next_address = select(of4, address_cnt, next_address);
+    usenew = select(of4, ~eq(address & 0xffff0, address_cnt & 0xffff0), usenew);
 
+    if (pcm.nfs)
+    {
+        select(active, next_address, address).store(&pcm.ram1[4][slot]);
+        ram2_8 = (ram2_8 & ~0x8000) | (next_b15 & 0x8000);
+    }
 
-                tt[0] = (int)((pcm.ram1[30][3] & ~write_mask) << 12);
-                tt[1] = (int)((pcm.ram1[30][5] & ~write_mask) << 12);
+    // wave rom reads
+    int32_t rom_address[5][width];
+    int32_t rom_data[5][width];
+    for (int i = 0; i < 4; i++)
+        samp_address[i].store(rom_address[i]);
+    (hiaddr | wave_address).store(rom_address[4]);
+    for (int j = 0; j < width; j++)
+    {
+        for (int i = 0; i < 4; i++)
+            rom_data[i][j] = (int8_t)PCM_ReadROM(rom_address[i][j]);
+        rom_data[4][j] = PCM_ReadROM(rom_address[4][j]);
+    }
+    L newnibble = L::load(rom_data[4]);
+    newnibble = select(newnibble_sel, (newnibble >> 4) & 15, newnibble & 15);
 
-                mcu->MCU_PostSample(tt);
-            }
-        }
+    // dpcm and interpolation
 
-        { // global counter for envelopes
-            if (!pcm.nfs)
-                pcm.tv_counter = pcm.ram2[31][8]; // fixme
+    L reference = L::load(&pcm.ram1[5][slot]);
+    L test = reference;
+    for (int i = 0; i < 4; i++)
+    {
+        L samp = L::load(rom_data[i]);
+        L shift = (L(10) - select(nibble_cmp[i], old_nibble, newnibble)) & 15;
 
-            pcm.tv_counter -= 1;
+        L shifted = sra((samp << 10) << 1, shift);
+        L of = gt(sub_phase_of, L(i));
+        reference = select(of, addclip20_lanes(reference, shifted >> 1, shifted & 1), reference);
 
-            pcm.tv_counter &= 0x3fff;
+        if (i < 3)
+        {
+            L step = multi_lanes(gather(interp_lut[i], interp_ratio) << 6, samp) >> 8;
+            step = sra(step << 1, shift);
+            test = addclip20_lanes(test, step >> 1, step & 1);
         }
+    }
 
-        // chorus/reverb
+    L reg1 = L::load(&pcm.ram1[1][slot]);
+    L reg3 = L::load(&pcm.ram1[3][slot]);
+    L ram2_6 = L::load(&pcm.ram2[6][slot]);
+    L reg2_6 = (ram2_6 >> 8) & 127;
 
-        { // fixme
-            if (pcm.ram2[31][8] & 0x8000)
-                pcm.ram2[31][9] = pcm.ram2[31][8] & 0x7fff;
-            else
-                pcm.ram2[31][10] = pcm.ram2[31][8] & 0x7fff;
+    L filter = L::load(&pcm.ram2[11][slot]);
+    L filter_hi = s8_lanes(filter >> 8);
+    L filter_lo = (filter >> 1) & 127;
+    L v1, v3;
 
-            if ((0x4000 - pcm.ram2[31][8]) & 0x8000)
-                pcm.ram2[31][10] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
-            else
-                pcm.ram2[31][9] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
+    if (mcu->mcu_mk1)
+    {
+        L mult1 = multi_lanes(reg1, filter_hi); // 8
+        L mult2 = multi_lanes(reg1, filter_lo); // 9
+        L mult3 = multi_lanes(reg1, reg2_6); // 10
+
+        L v2 = addclip20_lanes(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
+        v1 = addclip20_lanes(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
+        L subvar = addclip20_lanes(v1, mult3 >> 6, (mult3 >> 5) & 1); // 11
+
+        v3 = addclip20_lanes(test, subvar ^ 0xfffff, L(1)); // 12
+
+        L mult4 = multi_lanes(v3, filter_hi);
+        L mult5 = multi_lanes(v3, filter_lo);
+        L v4 = addclip20_lanes(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
+        reg1 = addclip20_lanes(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
+    }
+    else
+    {
+        L mult1 = mul(reg1, filter_hi); // 8
+        L mult2 = mul(reg1, filter_lo); // 9
+        L mult3 = mul(reg1, reg2_6); // 10
+
+        L v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
+        v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
+        L subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
+
+        v3 = sx20_lanes(test) - subvar; // 12
+
+        L mult4 = mul(v3, filter_hi);
+        L mult5 = mul(v3, filter_lo);
+        L v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
+        reg1 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
+    }
+
+    L irq = active & ~eq(ram2_6 & 1, zero) & eq(ram2_8 & 0x4000, zero) & irq_flag;
+    irq.store(&mix->irq[slot]);
+
+    L volmul1, volmul2;
+    L ram2_9 = calc_tv_lanes(&pcm, 0, L::load(&pcm.ram2[3][slot]), L::load(&pcm.ram2[9][slot]), active, &volmul1);
+    L ram2_10 = calc_tv_lanes(&pcm, 1, L::load(&pcm.ram2[4][slot]), L::load(&pcm.ram2[10][slot]), active, &volmul2);
+    L ram2_11 = calc_tv_lanes<L>(&pcm, 2, L::load(&pcm.ram2[5][slot]), filter, active, nullptr);
+
+    L sample = select(eq(ram2_6 & 2, zero), v1, v3);
+
+    L multiv1 = multi_lanes(sample, volmul1 >> 8);
+    L multiv2 = multi_lanes(sample, (volmul1 >> 1) & 127);
+    L sample2 = addclip20_lanes(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
+
+    L multiv3 = multi_lanes(sample2, volmul2 >> 8);
+    L multiv4 = multi_lanes(sample2, (volmul2 >> 1) & 127);
+    L sample3 = addclip20_lanes(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
+
+    L pan = L::load(&pcm.ram2[1][slot]) & active;
+    L rc = L::load(&pcm.ram2[2][slot]) & active;
+
+    multi_lanes(sample3, pan >> 8).store(&mix->sampl[slot]);
+    multi_lanes(sample3, pan).store(&mix->sampr[slot]);
+    (multi_lanes(sample3, rc >> 8) >> 5).store(&mix->rc0[slot]); // reverb
+    (multi_lanes(sample3, rc) >> 5).store(&mix->rc1[slot]); // chorus
+
+    if (pcm.nfs)
+    {
+        L nibble = select(usenew | kon, newnibble, old_nibble);
+        ram2_7 = select(key, (ram2_7 & ~0xf020) | (nibble << 12) | 0x20, ram2_7);
+
+        reg1 = reg1 & active;
+        v1 = v1 & active;
+        reference = reference & active;
+    }
+
+    reg1.store(&pcm.ram1[1][slot]);
+    v1.store(&pcm.ram1[3][slot]);
+    reference.store(&pcm.ram1[5][slot]);
+    ram2_7.store(&pcm.ram2[7][slot]);
+    (ram2_8 & active).store(&pcm.ram2[8][slot]);
+    (ram2_9 & active).store(&pcm.ram2[9][slot]);
+    (ram2_10 & active).store(&pcm.ram2[10][slot]);
+    ram2_11.store(&pcm.ram2[11][slot]);
+}
+
+// Runs the lanes on a group of slots unless most of them are idle
+template <typename L>
+void Pcm::PCM_UpdateGroup(int slot, uint32_t awake, int voice_active, pcm_slot_mix_t *mix)
+{
+    uint32_t group = (awake >> slot) & ((1u << L::width) - 1);
+    if (std::popcount(group) > L::width / 4)
+    {
+        PCM_UpdateLanes<L>(slot, voice_active, mix);
+        return;
+    }
+    for (int i = 0; i < L::width; i++)
+    {
+        if ((group >> i) & 1)
+            PCM_UpdateLanes<pcm_lanes_1>(slot + i, voice_active, mix);
+        else
+            PCM_UpdateIdle(slot + i, mix);
+    }
+}
+
+// The reverb/chorus slots 28-31 of a frame. They depend on the reverb and
+// chorus sums of the previous frame and produce the rcadd terms mixed in by
+// the voices of this one, so frames can't be batched.
+void Pcm::PCM_UpdateEffects(int *rcadd, int *rcadd2)
+{
+    { // fixme
+        if (pcm.ram2[8][31] & 0x8000)
+            pcm.ram2[9][31] = pcm.ram2[8][31] & 0x7fff;
+        else
+            pcm.ram2[10][31] = pcm.ram2[8][31] & 0x7fff;
+
+        if ((0x4000 - pcm.ram2[8][31]) & 0x8000)
+            pcm.ram2[10][31] = (0x4000 - pcm.ram2[8][31]) & 0x7fff;
+        else
+            pcm.ram2[9][31] = (0x4000 - pcm.ram2[8][31]) & 0x7fff;
+    }
+
+    // Voices in the effect slots would overwrite the delay line registers
+    if ((pcm.config_reg_3d & 31) + 1 > 28)
+        pcm.effects_quiet = 0;
+
+    // Nothing sent and the delay lines silent, the delay line code would
+    // only write back zeros
+    int quiet = !pcm.rcsum[0] && !pcm.rcsum[1];
+    int bypass = skip_idle && quiet && pcm.effects_quiet >= PCM_ERAM_SIZE;
+    pcm.eram_heard = 0;
+
+    if (!bypass)
+    {
+        int v1 = pcm.ram2[1][31];
+
+        int m1 = multi(pcm.ram1[1][29], v1 >> 8) >> 5; // 14
+        int m2 = multi(pcm.rcsum[1], v1 & 255) >> 5; // 15
+
+        pcm.ram1[1][29] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1); // 16
+    }
+
+    {
+        int okey = (pcm.ram2[7][31] & 0x20) != 0;
+        int key = 1;
+        int active = okey && key;
+        int u = 0;
+        calc_tv(&pcm, 1, pcm.ram2[0][30], &pcm.ram2[9][30], active, &u);
+    }
+
+    if (!bypass)
+    {
+        int v1 = pcm.ram2[1][30];
+        int m1 = multi(pcm.ram1[0][29], v1 >> 8) >> 5; // 17
+        int m2 = multi(pcm.rcsum[0], v1 & 255) >> 5; // 18
+
+        pcm.ram1[0][29] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1); // 19
+    }
+
+    if (!bypass)
+    {
+        {
+            // 1
+            int v1 = pcm.ram2[4][30];
+            int m1 = multi(pcm.ram1[0][29], (v1 >> 8)) >> 6;
+            int v2 = 0;
+            int s1 = eram_unpack(&pcm, pcm.ram2[1][28] + pcm.tv_counter, 1);
+            int s2 = eram_unpack(&pcm, pcm.ram2[1][28] + pcm.tv_counter);
+            if ((v1 & 0x30) != 0)
+            {
+                v2 = s1;
+            }
+            int v3 = addclip20(m1, v2 ^ 0xfffff, 1);
+            pcm.ram1[4][29] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[5][29] = addclip20(m2 >> 1, s2, m2 & 1);
+        }
+        {
+            // 2
+            int v1 = pcm.ram2[4][30];
+            int v2 = 0;
+            int s1 = eram_unpack(&pcm, pcm.ram2[2][28] + pcm.tv_counter, 1);
+            int s2 = eram_unpack(&pcm, pcm.ram2[2][28] + pcm.tv_counter);
+            if ((v1 & 0x30) != 0)
+            {
+                v2 = s1;
+            }
+            int v3 = addclip20(pcm.ram1[5][29], v2 ^ 0xfffff, 1);
+            pcm.ram1[5][29] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[0][28] = addclip20(m2 >> 1, s2, m2 & 1);
         }
+        {
+            // 3
+            int v1 = pcm.ram2[4][30];
+            int v2 = 0;
+            int s1 = eram_unpack(&pcm, pcm.ram2[3][28] + pcm.tv_counter, 1);
+            int s2 = eram_unpack(&pcm, pcm.ram2[3][28] + pcm.tv_counter);
+            if ((v1 & 0x30) != 0)
+            {
+                v2 = s1;
+            }
+            int v3 = addclip20(pcm.ram1[0][28], v2 ^ 0xfffff, 1);
+            pcm.ram1[0][28] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[1][28] = addclip20(m2 >> 1, s2, m2 & 1);
+
 
+            pcm.ram1[2][28] = eram_unpack(&pcm, pcm.ram2[5][28] + pcm.tv_counter);
+        }
         {
-            int v1 = pcm.ram2[31][1];
+            // 4
+            int v1 = pcm.ram2[5][30];
+            int v2 = 0;
+            int s1 = eram_unpack(&pcm, pcm.ram2[4][28] + pcm.tv_counter, 1);
+            int s2 = eram_unpack(&pcm, pcm.ram2[4][28] + pcm.tv_counter);
+            if ((v1 & 0x30) != 0)
+            {
+                v2 = s1;
+            }
+            int v3 = addclip20(pcm.ram1[1][28], v2 ^ 0xfffff, 1);
+            pcm.ram1[1][28] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[3][28] = addclip20(m2 >> 1, s2, m2 & 1);
 
-            int m1 = multi(pcm.ram1[29][1], v1 >> 8) >> 5; // 14
-            int m2 = multi(pcm.rcsum[1], v1 & 255) >> 5; // 15
 
-            pcm.ram1[29][1] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1); // 16
+            pcm.ram1[4][28] = eram_unpack(&pcm, pcm.ram2[1][29] + pcm.tv_counter);
         }
+        {
+            // 5
+
+            int v1 = pcm.ram2[7][30];
+            int m1 = multi(pcm.ram1[2][29], (v1 >> 8)) >> 5;
+            int s1 = eram_unpack(&pcm, pcm.ram2[0][29] + pcm.tv_counter);
+            int m2 = multi(s1, v1 & 255) >> 5;
+            pcm.ram1[2][29] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1);
 
+            eram_pack(&pcm, pcm.ram2[0][28] + pcm.tv_counter, pcm.ram1[4][29]);
+        }
         {
-            int okey = (pcm.ram2[31][7] & 0x20) != 0;
-            int key = 1;
-            int active = okey && key;
-            int u = 0;
-            calc_tv(&pcm, 1, pcm.ram2[30][0], &pcm.ram2[30][9], active, &u);
+            // 6
+
+            int v1 = pcm.ram2[8][30];
+            int m1 = multi(pcm.ram1[3][29], (v1 >> 8)) >> 5;
+            int s1 = eram_unpack(&pcm, pcm.ram2[8][29] + pcm.tv_counter);
+            int m2 = multi(s1, v1 & 255) >> 5;
+            pcm.ram1[3][29] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1);
+
+            eram_pack(&pcm, pcm.ram2[1][28] + pcm.tv_counter, pcm.ram1[5][29]);
+
+            eram_pack(&pcm, pcm.ram2[2][28] + pcm.tv_counter, pcm.ram1[0][28]);
         }
+        {
+            // 7
+
+            int v1 = pcm.ram2[9][30];
+            int v2 = pcm.ram1[3][28];
+            int m1 = multi(pcm.ram1[2][29], (v1 >> 8)) >> 5;
+            int m2 = multi(pcm.ram1[3][29], (v1 >> 8)) >> 5;
+            pcm.ram1[3][28] = addclip20(v2, m1 >> 1, m1 & 1);
+            pcm.ram1[5][28] = addclip20(v2, m2 >> 1, m2 & 1);
 
+            eram_pack(&pcm, pcm.ram2[3][28] + pcm.tv_counter, pcm.ram1[1][28]);
+        }
         {
-            int v1 = pcm.ram2[30][1];
-            int m1 = multi(pcm.ram1[29][0], v1 >> 8) >> 5; // 17
-            int m2 = multi(pcm.rcsum[0], v1 & 255) >> 5; // 18
+            // 8
+
+            int v1 = pcm.ram2[6][30];
+            int m1 = multi(pcm.ram1[2][28], v1 >> 8) >> 5;
 
-            pcm.ram1[29][0] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1); // 19
+            int v2 = addclip20(pcm.ram1[3][28], m1 >> 1, m1 & 1);
+            pcm.ram1[3][28] = v2;
+            int m2 = multi(v2, v1 & 255) >> 5;
+            pcm.ram1[2][28] = addclip20(pcm.ram1[2][28], m2 >> 1, m2 & 1);
+
+
+            pcm.ram1[1][28] = eram_unpack(&pcm, pcm.ram2[9][28] + pcm.tv_counter);
         }
+        {
+            // 9
+
+            int v1 = pcm.ram2[6][30];
+            int m1 = multi(pcm.ram1[4][28], v1 >> 8) >> 5;
+
+            int v2 = addclip20(pcm.ram1[5][28], m1 >> 1, m1 & 1);
+            pcm.ram1[5][28] = v2;
+            int m2 = multi(v2, v1 & 255) >> 5;
+            pcm.ram1[4][28] = addclip20(pcm.ram1[4][28], m2 >> 1, m2 & 1);
 
-        int rcadd[6] = {};
-        int rcadd2[6] = {};
 
+            pcm.ram1[4][29] = eram_unpack(&pcm, pcm.ram2[5][29] + pcm.tv_counter);
+        }
         {
-            {
-                // 1
-                int v1 = pcm.ram2[30][4];
-                int m1 = multi(pcm.ram1[29][0], (v1 >> 8)) >> 6;
-                int v2 = 0;
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][1] + pcm.tv_counter, 1);
-                int s2 = eram_unpack(&pcm, pcm.ram2[28][1] + pcm.tv_counter);
-                if ((v1 & 0x30) != 0)
-                {
-                    v2 = s1;
-                }
-                int v3 = addclip20(m1, v2 ^ 0xfffff, 1);
-                pcm.ram1[29][4] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[29][5] = addclip20(m2 >> 1, s2, m2 & 1);
-            }
-            {
-                // 2
-                int v1 = pcm.ram2[30][4];
-                int v2 = 0;
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][2] + pcm.tv_counter, 1);
-                int s2 = eram_unpack(&pcm, pcm.ram2[28][2] + pcm.tv_counter);
-                if ((v1 & 0x30) != 0)
-                {
-                    v2 = s1;
-                }
-                int v3 = addclip20(pcm.ram1[29][5], v2 ^ 0xfffff, 1);
-                pcm.ram1[29][5] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[28][0] = addclip20(m2 >> 1, s2, m2 & 1);
-            }
-            {
-                // 3
-                int v1 = pcm.ram2[30][4];
-                int v2 = 0;
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][3] + pcm.tv_counter, 1);
-                int s2 = eram_unpack(&pcm, pcm.ram2[28][3] + pcm.tv_counter);
-                if ((v1 & 0x30) != 0)
-                {
-                    v2 = s1;
-                }
-                int v3 = addclip20(pcm.ram1[28][0], v2 ^ 0xfffff, 1);
-                pcm.ram1[28][0] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[28][1] = addclip20(m2 >> 1, s2, m2 & 1);
+            // 10
+
+            int v1 = pcm.ram2[6][30];
+            int v2 = pcm.ram1[1][28];
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int s1 = eram_unpack(&pcm, pcm.ram2[8][28] + pcm.tv_counter);
+            int v3 = addclip20(m1 >> 1, s1, m1 & 1);
+            pcm.ram1[1][28] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[5][29] = addclip20(m2 >> 1, v2, m2 & 1);
+
+            eram_pack(&pcm, pcm.ram2[4][28] + pcm.tv_counter, pcm.ram1[3][28]);
+        }
+        {
+            // 11
 
+            int v1 = pcm.ram2[6][30];
+            int v2 = pcm.ram1[4][29];
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int s1 = eram_unpack(&pcm, pcm.ram2[4][29] + pcm.tv_counter);
+            int v3 = addclip20(m1 >> 1, s1, m1 & 1);
+            pcm.ram1[4][29] = v3;
+            int m2 = multi(v3, v1 & 255) >> 5;
+            pcm.ram1[0][28] = addclip20(m2 >> 1, v2, m2 & 1);
 
-                pcm.ram1[28][2] = eram_unpack(&pcm, pcm.ram2[28][5] + pcm.tv_counter);
-            }
-            {
-                // 4
-                int v1 = pcm.ram2[30][5];
-                int v2 = 0;
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][4] + pcm.tv_counter, 1);
-                int s2 = eram_unpack(&pcm, pcm.ram2[28][4] + pcm.tv_counter);
-                if ((v1 & 0x30) != 0)
-                {
-                    v2 = s1;
-                }
-                int v3 = addclip20(pcm.ram1[28][1], v2 ^ 0xfffff, 1);
-                pcm.ram1[28][1] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[28][3] = addclip20(m2 >> 1, s2, m2 & 1);
 
+            eram_pack(&pcm, pcm.ram2[5][28] + pcm.tv_counter, pcm.ram1[2][28]);
 
-                pcm.ram1[28][4] = eram_unpack(&pcm, pcm.ram2[29][1] + pcm.tv_counter);
-            }
-            {
-                // 5
+            eram_pack(&pcm, pcm.ram2[0][29] + pcm.tv_counter, pcm.ram1[5][28]);
+        }
+        {
+            // 12
 
-                int v1 = pcm.ram2[30][7];
-                int m1 = multi(pcm.ram1[29][2], (v1 >> 8)) >> 5;
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][0] + pcm.tv_counter);
-                int m2 = multi(s1, v1 & 255) >> 5;
-                pcm.ram1[29][2] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1);
+            pcm.ram1[5][28] = eram_unpack(&pcm, pcm.ram2[6][28] + pcm.tv_counter);
+        }
 
-                eram_pack(&pcm, pcm.ram2[28][0] + pcm.tv_counter, pcm.ram1[29][4]);
-            }
-            {
-                // 6
+        {
+            // 13
 
-                int v1 = pcm.ram2[30][8];
-                int m1 = multi(pcm.ram1[29][3], (v1 >> 8)) >> 5;
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][8] + pcm.tv_counter);
-                int m2 = multi(s1, v1 & 255) >> 5;
-                pcm.ram1[29][3] = addclip20(m1 >> 1, m2 >> 1, (m1 | m2) & 1);
+            int s1 = eram_unpack(&pcm, pcm.ram2[10][28] + pcm.tv_counter);
+            pcm.ram1[5][28] = addclip20(pcm.ram1[5][28], s1, 0);
 
-                eram_pack(&pcm, pcm.ram2[28][1] + pcm.tv_counter, pcm.ram1[29][5]);
+            pcm.ram1[2][28] = eram_unpack(&pcm, pcm.ram2[2][29] + pcm.tv_counter);
+        }
 
-                eram_pack(&pcm, pcm.ram2[28][2] + pcm.tv_counter, pcm.ram1[28][0]);
-            }
-            {
-                // 7
+        {
+            // 14
 
-                int v1 = pcm.ram2[30][9];
-                int v2 = pcm.ram1[28][3];
-                int m1 = multi(pcm.ram1[29][2], (v1 >> 8)) >> 5;
-                int m2 = multi(pcm.ram1[29][3], (v1 >> 8)) >> 5;
-                pcm.ram1[28][3] = addclip20(v2, m1 >> 1, m1 & 1);
-                pcm.ram1[28][5] = addclip20(v2, m2 >> 1, m2 & 1);
+            int s1 = eram_unpack(&pcm, pcm.ram2[6][29] + pcm.tv_counter);
+            int t1 = addclip20(s1, pcm.ram1[2][28], 0); // 6
 
-                eram_pack(&pcm, pcm.ram2[28][3] + pcm.tv_counter, pcm.ram1[28][1]);
-            }
-            {
-                // 8
+            pcm.ram1[5][28] = addclip20(t1, pcm.ram1[5][28], 0);
 
-                int v1 = pcm.ram2[30][6];
-                int m1 = multi(pcm.ram1[28][2], v1 >> 8) >> 5;
+            pcm.ram1[2][28] = eram_unpack(&pcm, pcm.ram2[7][28] + pcm.tv_counter);
+        }
 
-                int v2 = addclip20(pcm.ram1[28][3], m1 >> 1, m1 & 1);
-                pcm.ram1[28][3] = v2;
-                int m2 = multi(v2, v1 & 255) >> 5;
-                pcm.ram1[28][2] = addclip20(pcm.ram1[28][2], m2 >> 1, m2 & 1);
+        {
+            // 15
 
+            int s1 = eram_unpack(&pcm, pcm.ram2[11][28] + pcm.tv_counter);
+            pcm.ram1[2][28] = addclip20(pcm.ram1[2][28], s1, 0);
 
-                pcm.ram1[28][1] = eram_unpack(&pcm, pcm.ram2[28][9] + pcm.tv_counter);
-            }
-            {
-                // 9
+            pcm.ram1[3][28] = eram_unpack(&pcm, pcm.ram2[3][29] + pcm.tv_counter);
+        }
 
-                int v1 = pcm.ram2[30][6];
-                int m1 = multi(pcm.ram1[28][4], v1 >> 8) >> 5;
+        {
+            // 16
 
-                int v2 = addclip20(pcm.ram1[28][5], m1 >> 1, m1 & 1);
-                pcm.ram1[28][5] = v2;
-                int m2 = multi(v2, v1 & 255) >> 5;
-                pcm.ram1[28][4] = addclip20(pcm.ram1[28][4], m2 >> 1, m2 & 1);
+            int s1 = eram_unpack(&pcm, pcm.ram2[7][29] + pcm.tv_counter);
+            int t1 = addclip20(s1, pcm.ram1[2][28], 0);
+            pcm.ram1[2][28] = addclip20(t1, pcm.ram1[3][28], 0);
 
 
-                pcm.ram1[29][4] = eram_unpack(&pcm, pcm.ram2[29][5] + pcm.tv_counter);
-            }
-            {
-                // 10
-
-                int v1 = pcm.ram2[30][6];
-                int v2 = pcm.ram1[28][1];
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][8] + pcm.tv_counter);
-                int v3 = addclip20(m1 >> 1, s1, m1 & 1);
-                pcm.ram1[28][1] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[29][5] = addclip20(m2 >> 1, v2, m2 & 1);
-
-                eram_pack(&pcm, pcm.ram2[28][4] + pcm.tv_counter, pcm.ram1[28][3]);
-            }
-            {
-                // 11
+            eram_pack(&pcm, pcm.ram2[1][29] + pcm.tv_counter, pcm.ram1[4][28]);
+
+            eram_pack(&pcm, pcm.ram2[8][28] + pcm.tv_counter, pcm.ram1[1][28]);
+        }
 
-                int v1 = pcm.ram2[30][6];
-                int v2 = pcm.ram1[29][4];
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][4] + pcm.tv_counter);
-                int v3 = addclip20(m1 >> 1, s1, m1 & 1);
-                pcm.ram1[29][4] = v3;
-                int m2 = multi(v3, v1 & 255) >> 5;
-                pcm.ram1[28][0] = addclip20(m2 >> 1, v2, m2 & 1);
+        {
+            // 17
+            int v1 = pcm.ram2[2][30];
+            int v2 = pcm.ram1[5][28];
 
+            int m1 = multi(v2, v1 >> 8) >> 5;
 
-                eram_pack(&pcm, pcm.ram2[28][5] + pcm.tv_counter, pcm.ram1[28][2]);
+            rcadd[0] = m1;
 
-                eram_pack(&pcm, pcm.ram2[29][0] + pcm.tv_counter, pcm.ram1[28][5]);
-            }
-            {
-                // 12
+            rcadd2[0] = multi(v2, v1 & 255) >> 5;
 
-                pcm.ram1[28][5] = eram_unpack(&pcm, pcm.ram2[28][6] + pcm.tv_counter);
-            }
+            int t1 = eram_unpack(&pcm, pcm.ram2[10][29] + pcm.tv_counter + 1); //? 3a6e
+            eram_pack(&pcm, pcm.ram2[9][28] + pcm.tv_counter, pcm.ram1[5][29]);
+            pcm.ram1[5][29] = t1;
+        }
 
-            {
-                // 13
+        {
+            // 18
+            int v1 = pcm.ram2[3][30];
+            int v2 = pcm.ram1[2][28];
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][10] + pcm.tv_counter);
-                pcm.ram1[28][5] = addclip20(pcm.ram1[28][5], s1, 0);
+            int m1 = multi(v2, v1 >> 8) >> 5;
 
-                pcm.ram1[28][2] = eram_unpack(&pcm, pcm.ram2[29][2] + pcm.tv_counter);
-            }
+            rcadd[1] = m1;
 
-            {
-                // 14
+            rcadd2[1] = multi(v2, v1 & 255) >> 5;
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][6] + pcm.tv_counter);
-                int t1 = addclip20(s1, pcm.ram1[28][2], 0); // 6
+            pcm.ram1[1][28] = eram_unpack(&pcm, pcm.ram2[11][29] + pcm.tv_counter + 1); //? 3a1e
+        }
+        {
+            // 19
 
-                pcm.ram1[28][5] = addclip20(t1, pcm.ram1[28][5], 0);
+            int v1 = pcm.ram2[9][31];
 
-                pcm.ram1[28][2] = eram_unpack(&pcm, pcm.ram2[28][7] + pcm.tv_counter);
-            }
+            int s1 = eram_unpack(&pcm, pcm.ram2[10][29] + pcm.tv_counter); //? 3a6d
 
-            {
-                // 15
+            eram_pack(&pcm, pcm.ram2[4][29] + pcm.tv_counter, pcm.ram1[4][29]);
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[28][11] + pcm.tv_counter);
-                pcm.ram1[28][2] = addclip20(pcm.ram1[28][2], s1, 0);
+            int m1 = multi(s1, v1 >> 8) >> 5;
+            int m2 = multi(pcm.ram1[5][29], v1 >> 8) >> 5;
 
-                pcm.ram1[28][3] = eram_unpack(&pcm, pcm.ram2[29][3] + pcm.tv_counter);
-            }
+            int t2 = addclip20(s1, (m1 >> 1) ^ 0xfffff, 1);
 
-            {
-                // 16
+            pcm.ram1[5][29] = addclip20(t2, m2 >> 1, m2 & 1);
+        }
+        {
+            // 20
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][7] + pcm.tv_counter);
-                int t1 = addclip20(s1, pcm.ram1[28][2], 0);
-                pcm.ram1[28][2] = addclip20(t1, pcm.ram1[28][3], 0);
+            int v1 = pcm.ram2[10][31];
 
+            int s1 = eram_unpack(&pcm, pcm.ram2[11][29] + pcm.tv_counter); //? 3a1d
 
-                eram_pack(&pcm, pcm.ram2[29][1] + pcm.tv_counter, pcm.ram1[28][4]);
+            eram_pack(&pcm, pcm.ram2[5][29] + pcm.tv_counter, pcm.ram1[0][28]);
 
-                eram_pack(&pcm, pcm.ram2[28][8] + pcm.tv_counter, pcm.ram1[28][1]);
-            }
+            int m1 = multi(s1, v1 >> 8) >> 5;
+            int m2 = multi(pcm.ram1[1][28], v1 >> 8) >> 5;
 
-            {
-                // 17
-                int v1 = pcm.ram2[30][2];
-                int v2 = pcm.ram1[28][5];
+            int t2 = addclip20(s1, (m1 >> 1) ^ 0xfffff, 1);
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
+            pcm.ram1[1][28] = addclip20(t2, m2 >> 1, m2 & 1);
 
-                rcadd[0] = m1;
+            eram_pack(&pcm, pcm.ram2[9][29] + pcm.tv_counter, pcm.ram1[1][29]);
+        }
+        {
+            // 21
 
-                rcadd2[0] = multi(v2, v1 & 255) >> 5;
+            int v1 = pcm.ram2[2][31];
+            int v2 = pcm.ram1[5][29];
 
-                int t1 = eram_unpack(&pcm, pcm.ram2[29][10] + pcm.tv_counter + 1); //? 3a6e
-                eram_pack(&pcm, pcm.ram2[28][9] + pcm.tv_counter, pcm.ram1[29][5]);
-                pcm.ram1[29][5] = t1;
-            }
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int m2 = multi(v2, v1 & 255) >> 5;
 
-            {
-                // 18
-                int v1 = pcm.ram2[30][3];
-                int v2 = pcm.ram1[28][2];
+            rcadd[2] = m1;
+            rcadd2[2] = m2;
+        }
+        {
+            // 22
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
+            int v1 = pcm.ram2[3][31];
+            int v2 = pcm.ram1[5][29];
 
-                rcadd[1] = m1;
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int m2 = multi(v2, v1 & 255) >> 5;
 
-                rcadd2[1] = multi(v2, v1 & 255) >> 5;
+            rcadd[3] = m1;
+            rcadd2[3] = m2;
+        }
+        {
+            // 23
 
-                pcm.ram1[28][1] = eram_unpack(&pcm, pcm.ram2[29][11] + pcm.tv_counter + 1); //? 3a1e
-            }
-            {
-                // 19
+            int v1 = pcm.ram2[4][31];
+            int v2 = pcm.ram1[1][28];
 
-                int v1 = pcm.ram2[31][9];
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int m2 = multi(v2, v1 & 255) >> 5;
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][10] + pcm.tv_counter); //? 3a6d
+            rcadd[4] = m1;
+            rcadd2[4] = m2;
+        }
+        {
+            // 31
 
-                eram_pack(&pcm, pcm.ram2[29][4] + pcm.tv_counter, pcm.ram1[29][4]);
+            int v1 = pcm.ram2[5][31];
+            int v2 = pcm.ram1[1][28];
 
-                int m1 = multi(s1, v1 >> 8) >> 5;
-                int m2 = multi(pcm.ram1[29][5], v1 >> 8) >> 5;
+            int m1 = multi(v2, v1 >> 8) >> 5;
+            int m2 = multi(v2, v1 & 255) >> 5;
 
-                int t2 = addclip20(s1, (m1 >> 1) ^ 0xfffff, 1);
+            rcadd[5] = m1;
+            rcadd2[5] = m2;
+        }
 
-                pcm.ram1[29][5] = addclip20(t2, m2 >> 1, m2 & 1);
-            }
-            {
-                // 20
+        // Silent frames in a row. After as many as there are eram words,
+        // tv_counter has swept every one of them past the read taps.
+        for (int i = 0; i < 6; i++)
+            quiet = quiet && !pcm.ram1[i][28] && !pcm.ram1[i][29];
+        if (quiet && !pcm.eram_heard && pcm.nfs)
+            pcm.effects_quiet = std::min<uint32_t>(pcm.effects_quiet + 1, PCM_ERAM_SIZE);
+        else
+            pcm.effects_quiet = 0;
+    }
 
-                int v1 = pcm.ram2[31][10];
+    {
+        // address generator
+
+        int key = 1;
+        int okey = (pcm.ram2[7][31] & 0x20) != 0;
+        int active = key && okey;
+        int kon = key && !okey;
+
+        int b15 = (pcm.ram2[8][31] & 0x8000) != 0; // 0
+        int b6 = (pcm.ram2[7][31] & 0x40) != 0; // 1
+        int b7 = (pcm.ram2[7][31] & 0x80) != 0; // 1
+        int old_nibble = (pcm.ram2[7][31] >> 12) & 15; // 1
+
+        int address = pcm.ram1[4][31]; // 0
+        int address_end = pcm.ram1[0][31]; // 1 or 2
+        int address_loop = pcm.ram1[2][31]; // 2 or 1
+
+        int sub_phase = (pcm.ram2[8][31] & 0x3fff); // 1
+        int interp_ratio = (sub_phase >> 7) & 127;
+        sub_phase += pcm.ram2[0][pcm.ram2[7][31] & 31]; // 5
+        int sub_phase_of = (sub_phase >> 14) & 7;
+        if (pcm.nfs)
+        {
+            pcm.ram2[8][31] &= ~0x3fff;
+            pcm.ram2[8][31] |= sub_phase & 0x3fff;
+        }
 
-                int s1 = eram_unpack(&pcm, pcm.ram2[29][11] + pcm.tv_counter); //? 3a1d
 
-                eram_pack(&pcm, pcm.ram2[29][5] + pcm.tv_counter, pcm.ram1[28][0]);
+        // address 0
+        int address_cnt = address;
 
-                int m1 = multi(s1, v1 >> 8) >> 5;
-                int m2 = multi(pcm.ram1[28][1], v1 >> 8) >> 5;
+        int cmp1 = b15 ? address_loop : address_end;
+        int cmp2 = address_cnt;
+        int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
+        int next_b15 = b15;
 
-                int t2 = addclip20(s1, (m1 >> 1) ^ 0xfffff, 1);
+        int next_address = address_cnt; // 11
 
-                pcm.ram1[28][1] = addclip20(t2, m2 >> 1, m2 & 1);
+        cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+        cmp2 = address_cnt;
+        int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-                eram_pack(&pcm, pcm.ram2[29][9] + pcm.tv_counter, pcm.ram1[29][1]);
-            }
-            {
-                // 21
+        int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+        int address_sub = !address_cmp && b6 && b15;
+        if (b7)
+            address_cnt2 -= address_add - address_sub;
+        else
+            address_cnt2 += address_add - address_sub;
+        address_cnt = address_cnt2 & 0xfffff; // 11
+        b15 = b6 && (b15 ^ address_cmp); // 11
 
-                int v1 = pcm.ram2[31][2];
-                int v2 = pcm.ram1[29][5];
+        cmp1 = b15 ? address_loop : address_end;
+        cmp2 = address_cnt;
+        address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int m2 = multi(v2, v1 & 255) >> 5;
+        if (sub_phase_of >= 1)
+        {
+            next_address = address_cnt; // 13
+            next_b15 = b15;
+        }
 
-                rcadd[2] = m1;
-                rcadd2[2] = m2;
-            }
-            {
-                // 22
+        if (active && pcm.nfs)
+            pcm.ram1[4][31] = next_address;
 
-                int v1 = pcm.ram2[31][3];
-                int v2 = pcm.ram1[29][5];
+        if (pcm.nfs)
+        {
+            pcm.ram2[8][31] &= ~0x8000;
+            pcm.ram2[8][31] |= next_b15 << 15;
+        }
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int m2 = multi(v2, v1 & 255) >> 5;
+        int t1 = address_loop; // 18
+        int t2 = pcm.ram1[4][31] - t1; // 19
+        int t3 = address_end - t2; // 20
+        int t4 = pcm.ram1[4][31]; // 23
 
-                rcadd[3] = m1;
-                rcadd2[3] = m2;
-            }
+        pcm.ram2[10][29] = t3;
+        pcm.ram2[11][29] = t4;
+    }
+}
+
+// Renders frames up to the given cycle count into the sample buffer of the
+// MCU. The configuration can only change between calls, so all of them
+// have the same length.
+void Pcm::PCM_Update(uint64_t cycles)
+{
+    if (pcm.cycles >= cycles)
+        return;
+
+    uint64_t frame_cycles = PCM_GetFrameCycles();
+    uint64_t frames = (cycles - pcm.cycles + frame_cycles - 1) / frame_cycles;
+    int samples = PCM_GetFrameSamples();
+    while (frames)
+    {
+        int n = std::min<uint64_t>(frames, (audio_buffer_size - mcu->sample_write_ptr) / samples);
+        if (n == 0)
+        {
+            // a frame across the end of the buffer, after a switch of the
+            // output mode left sample_write_ptr odd
+            int32_t frame[2][2];
+            PCM_RenderFrames(1, frame[0]);
+            for (int i = 0; i < samples; i++)
             {
-                // 23
+                mcu->sample_buffer[mcu->sample_write_ptr][0] = frame[i][0];
+                mcu->sample_buffer[mcu->sample_write_ptr][1] = frame[i][1];
+                mcu->sample_write_ptr = (mcu->sample_write_ptr + 1) % audio_buffer_size;
+            }
+            frames--;
+            continue;
+        }
+        PCM_RenderFrames(n, mcu->sample_buffer[mcu->sample_write_ptr]);
+        mcu->sample_write_ptr = (mcu->sample_write_ptr + n * samples) % audio_buffer_size;
+        frames -= n;
+    }
+}
 
-                int v1 = pcm.ram2[31][4];
-                int v2 = pcm.ram1[28][1];
+// Renders a run of frames, PCM_GetFrameSamples() stereo samples each, into
+// out as interleaved left/right values
+void Pcm::PCM_RenderFrames(int frames, int32_t *out)
+{
+    int reg_slots = (pcm.config_reg_3d & 31) + 1;
+    int voice_active = pcm.voice_mask & pcm.voice_mask_pending;
+    int oversampling = PCM_GetFrameSamples() == 2;
+    // the voice mask only changes on a PCM_Read, so once per run is enough
+    pcm.active_peak = std::max(pcm.active_peak,
+        std::popcount((uint32_t)voice_active & ((1u << std::min(reg_slots, 28)) - 1)));
+    for (; frames > 0; frames--, out += oversampling ? 4 : 2)
+    {
+        int tt[2] = {};
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int m2 = multi(v2, v1 & 255) >> 5;
+        { // final mixing
+            int noise_mask = 0;
+            int orval = 0;
+            int write_mask = 3;
+            // int dac_mask = -4;
 
-                rcadd[4] = m1;
-                rcadd2[4] = m2;
-            }
-            {
-                // 31
 
-                int v1 = pcm.ram2[31][5];
-                int v2 = pcm.ram1[28][1];
+            int shifter = pcm.ram2[10][30];
+            int xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
+            shifter = (shifter >> 1) | (xr << 15);
+            pcm.ram2[10][30] = shifter;
 
-                int m1 = multi(v2, v1 >> 8) >> 5;
-                int m2 = multi(v2, v1 & 255) >> 5;
+            pcm.accum_l = addclip20(pcm.accum_l, pcm.ram1[0][30], 0);
+            pcm.accum_r = addclip20(pcm.accum_r, pcm.ram1[1][30], 0);
 
-                rcadd[5] = m1;
-                rcadd2[5] = m2;
+            pcm.ram1[2][30] = addclip20(pcm.accum_l,
+                orval | (shifter & noise_mask), 0);
 
-                {
-                    // address generator
-
-                    int key = 1;
-                    int okey = (pcm.ram2[31][7] & 0x20) != 0;
-                    int active = key && okey;
-                    int kon = key && !okey;
-
-                    int b15 = (pcm.ram2[31][8] & 0x8000) != 0; // 0
-                    int b6 = (pcm.ram2[31][7] & 0x40) != 0; // 1
-                    int b7 = (pcm.ram2[31][7] & 0x80) != 0; // 1
-                    int old_nibble = (pcm.ram2[31][7] >> 12) & 15; // 1
-
-                    int address = pcm.ram1[31][4]; // 0
-                    int address_end = pcm.ram1[31][0]; // 1 or 2
-                    int address_loop = pcm.ram1[31][2]; // 2 or 1
-
-                    int sub_phase = (pcm.ram2[31][8] & 0x3fff); // 1
-                    int interp_ratio = (sub_phase >> 7) & 127;
-                    sub_phase += pcm.ram2[pcm.ram2[31][7] & 31][0]; // 5
-                    int sub_phase_of = (sub_phase >> 14) & 7;
-                    if (pcm.nfs)
-                    {
-                        pcm.ram2[31][8] &= ~0x3fff;
-                        pcm.ram2[31][8] |= sub_phase & 0x3fff;
-                    }
+            pcm.ram1[4][30] = addclip20(pcm.accum_r,
+                orval | (shifter & noise_mask), 0);
 
+            pcm.ram1[0][30] = pcm.accum_l & write_mask;
+            pcm.ram1[1][30] = pcm.accum_r & write_mask;
+            
 
-                    // address 0
-                    int address_cnt = address;
+            tt[0] = (int)((pcm.ram1[2][30] & ~write_mask) << 12);
+            tt[1] = (int)((pcm.ram1[4][30] & ~write_mask) << 12);
 
-                    int cmp1 = b15 ? address_loop : address_end;
-                    int cmp2 = address_cnt;
-                    int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
-                    int next_b15 = b15;
+            out[0] = tt[0];
+            out[1] = tt[1];
 
-                    int next_address = address_cnt; // 11
+            xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
+            shifter = (shifter >> 1) | (xr << 15);
 
-                    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-                    cmp2 = address_cnt;
-                    int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+            pcm.accum_l = addclip20(pcm.accum_l, pcm.ram1[0][30], 0);
+            pcm.accum_r = addclip20(pcm.accum_r, pcm.ram1[1][30], 0);
 
-                    int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-                    int address_sub = !address_cmp && b6 && b15;
-                    if (b7)
-                        address_cnt2 -= address_add - address_sub;
-                    else
-                        address_cnt2 += address_add - address_sub;
-                    address_cnt = address_cnt2 & 0xfffff; // 11
-                    b15 = b6 && (b15 ^ address_cmp); // 11
+            pcm.ram1[3][30] = addclip20(pcm.accum_l,
+                orval | (shifter & noise_mask), 0);
 
-                    cmp1 = b15 ? address_loop : address_end;
-                    cmp2 = address_cnt;
-                    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
+            pcm.ram1[5][30] = addclip20(pcm.accum_r,
+                orval | (shifter & noise_mask), 0);
 
-                    if (sub_phase_of >= 1)
-                    {
-                        next_address = address_cnt; // 13
-                        next_b15 = b15;
-                    }
+            if (oversampling)
+            {
+                pcm.ram2[10][30] = shifter;
 
-                    if (active && pcm.nfs)
-                        pcm.ram1[31][4] = next_address;
+                pcm.ram1[0][30] = pcm.accum_l & write_mask;
+                pcm.ram1[1][30] = pcm.accum_r & write_mask;
 
-                    if (pcm.nfs)
-                    {
-                        pcm.ram2[31][8] &= ~0x8000;
-                        pcm.ram2[31][8] |= next_b15 << 15;
-                    }
 
-                    int t1 = address_loop; // 18
-                    int t2 = pcm.ram1[31][4] - t1; // 19
-                    int t3 = address_end - t2; // 20
-                    int t4 = pcm.ram1[31][4]; // 23
+                tt[0] = (int)((pcm.ram1[3][30] & ~write_mask) << 12);
+                tt[1] = (int)((pcm.ram1[5][30] & ~write_mask) << 12);
 
-                    pcm.ram2[29][10] = t3;
-                    pcm.ram2[29][11] = t4;
-                }
+                out[2] = tt[0];
+                out[3] = tt[1];
             }
         }
 
-        pcm.ram1[31][1] = 0;
-        pcm.ram1[31][3] = 0;
+        { // global counter for envelopes
+            if (!pcm.nfs)
+                pcm.tv_counter = pcm.ram2[8][31]; // fixme
+
+            pcm.tv_counter -= 1;
+
+            pcm.tv_counter &= 0x3fff;
+        }
+
+        // chorus/reverb
+        int rcadd[6] = {};
+        int rcadd2[6] = {};
+        PCM_UpdateEffects(rcadd, rcadd2);
+
+        pcm.ram1[1][31] = 0;
+        pcm.ram1[3][31] = 0;
         pcm.rcsum[0] = 0;
         pcm.rcsum[1] = 0;
 
-        for (int slot = 0; slot < reg_slots; slot++)
+        if (engine == PCM_ENGINE_VECTOR && reg_slots <= 28)
         {
-            uint32_t *ram1 = pcm.ram1[slot];
-            uint16_t *ram2 = pcm.ram2[slot];
-            int okey = (ram2[7] & 0x20) != 0;
-            int key = (voice_active >> slot) & 1;
-
-            int active = okey && key;
-            int kon = key && !okey;
-
-            // address generator
-
-            int b15 = (ram2[8] & 0x8000) != 0; // 0
-            int b6 = (ram2[7] & 0x40) != 0; // 1
-            int b7 = (ram2[7] & 0x80) != 0; // 1
-            int hiaddr = (ram2[7] >> 8) & 15; // 1
-            int old_nibble = (ram2[7] >> 12) & 15; // 1
-
-            int address = ram1[4]; // 0
-            int address_end = ram1[0]; // 1 or 2
-            int address_loop = ram1[2]; // 2 or 1
-
-            int cmp1 = b15 ? address_loop : address_end;
-            int cmp2 = address;
-            int nibble_cmp1 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 2
-            int irq_flag = 0;
-
-            // fixme:
-            if (kon)
-                irq_flag = ((cmp1 + address_loop) & 0x100000) != 0;
-            else
-                irq_flag = ((address + ((-address_loop) & 0xfffff)) & 0x100000) != 0;
-            irq_flag ^= b7;
-
-            int nibble_address = (!b6 && nibble_cmp1) ? address_loop : address; // 3
-            int address_b4 = (nibble_address & 0x10) != 0;
-            int wave_address = nibble_address >> 5;
-            int xor2 = (address_b4 ^ b7);
-            int check1 = xor2 && active;
-            int xor1 = (b15 ^ !nibble_cmp1);
-            int nibble_add = b6 ? check1 && xor1 : (!nibble_cmp1 && check1);
-            int nibble_subtract = b6 && !xor1 && active && !xor2;
-            if (b7)
-                wave_address -= nibble_add - nibble_subtract;
-            else
-                wave_address += nibble_add - nibble_subtract;
-            wave_address &= 0xfffff;
-
-            int newnibble = PCM_ReadROM((hiaddr << 20) | wave_address);
-            int newnibble_sel = address_b4 ^ ((b6 || !nibble_cmp1) && okey);
-            if (newnibble_sel)
-                newnibble = (newnibble >> 4) & 15;
-            else
-                newnibble &= 15;
-
-            int sub_phase = (ram2[8] & 0x3fff); // 1
-            int interp_ratio = (sub_phase >> 7) & 127;
-            sub_phase += pcm.ram2[ram2[7] & 31][0]; // 5
-            int sub_phase_of = (sub_phase >> 14) & 7;
-            if (pcm.nfs)
+            // the lanes must not reach the effect slots, 28-31
+            pcm_slot_mix_t mix;
+            uint32_t awake = ~(pcm.voice_idle & ~voice_active);
+            int slot = 0;
+#ifdef PCM_LANES_AVX2
+            for (; slot + 8 <= reg_slots; slot += 8)
+                PCM_UpdateGroup<pcm_lanes_8>(slot, awake, voice_active, &mix);
+#endif
+#ifdef PCM_LANES_SSE2
+            for (; slot + 4 <= reg_slots; slot += 4)
+                PCM_UpdateGroup<pcm_lanes_4>(slot, awake, voice_active, &mix);
+#endif
+            for (; slot < reg_slots; slot++)
+                PCM_UpdateGroup<pcm_lanes_1>(slot, awake, voice_active, &mix);
+
+            for (slot = 0; slot < reg_slots; slot++)
             {
-                ram2[8] &= ~0x3fff;
-                ram2[8] |= sub_phase & 0x3fff;
+                if (mix.irq[slot] && !pcm.irq_assert)
+                    PCM_SlotIRQ(slot);
+                mix_slot(&pcm, slot, reg_slots, mix.sampl[slot], mix.sampr[slot], mix.rc0[slot], mix.rc1[slot],
+                    rcadd, rcadd2);
             }
+        }
+        else
+        {
+            for (int slot = 0; slot < reg_slots; slot++)
+            {
+                int okey = (pcm.ram2[7][slot] & 0x20) != 0;
+                int key = (voice_active >> slot) & 1;
 
+                if (!key && (pcm.voice_idle >> slot) & 1)
+                {
+                    calc_tv(&pcm, 2, pcm.ram2[5][slot], &pcm.ram2[11][slot], 0, NULL);
+                    mix_slot(&pcm, slot, reg_slots, 0, 0, 0, 0, rcadd, rcadd2);
+                    continue;
+                }
 
-            // address 0
-            int address_cnt = address;
-            int samp0 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 18
+                int active = okey && key;
+                int kon = key && !okey;
 
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp2 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 8
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
+                // address generator
 
-            int next_address = address_cnt; // 11
-            int usenew = !nibble_cmp2;
-            int next_b15 = b15;
+                int b15 = (pcm.ram2[8][slot] & 0x8000) != 0; // 0
+                int b6 = (pcm.ram2[7][slot] & 0x40) != 0; // 1
+                int b7 = (pcm.ram2[7][slot] & 0x80) != 0; // 1
+                int hiaddr = (pcm.ram2[7][slot] >> 8) & 15; // 1
+                int old_nibble = (pcm.ram2[7][slot] >> 12) & 15; // 1
 
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+                int address = pcm.ram1[4][slot]; // 0
+                int address_end = pcm.ram1[0][slot]; // 1 or 2
+                int address_loop = pcm.ram1[2][slot]; // 2 or 1
 
-            int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            int address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 11
-            b15 = b6 && (b15 ^ address_cmp); // 11
+                int cmp1 = b15 ? address_loop : address_end;
+                int cmp2 = address;
+                int nibble_cmp1 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 2
+                int irq_flag = 0;
 
-            int samp1 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 20
+                // fixme:
+                if (kon)
+                    irq_flag = ((cmp1 + address_loop) & 0x100000) != 0;
+                else
+                    irq_flag = ((address + ((-address_loop) & 0xfffff)) & 0x100000) != 0;
+                irq_flag ^= b7;
+
+                int nibble_address = (!b6 && nibble_cmp1) ? address_loop : address; // 3
+                int address_b4 = (nibble_address & 0x10) != 0;
+                int wave_address = nibble_address >> 5;
+                int xor2 = (address_b4 ^ b7);
+                int check1 = xor2 && active;
+                int xor1 = (b15 ^ !nibble_cmp1);
+                int nibble_add = b6 ? check1 && xor1 : (!nibble_cmp1 && check1);
+                int nibble_subtract = b6 && !xor1 && active && !xor2;
+                if (b7)
+                    wave_address -= nibble_add - nibble_subtract;
+                else
+                    wave_address += nibble_add - nibble_subtract;
+                wave_address &= 0xfffff;
 
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp3 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 12
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
+                int newnibble = PCM_ReadROM((hiaddr << 20) | wave_address);
+                int newnibble_sel = address_b4 ^ ((b6 || !nibble_cmp1) && okey);
+                if (newnibble_sel)
+                    newnibble = (newnibble >> 4) & 15;
+                else
+                    newnibble &= 15;
 
-            if (sub_phase_of >= 1)
-            {
-                next_address = address_cnt; // 13
-                usenew = !nibble_cmp3;
-                next_b15 = b15;
-            }
+                int sub_phase = (pcm.ram2[8][slot] & 0x3fff); // 1
+                int interp_ratio = (sub_phase >> 7) & 127;
+                sub_phase += pcm.ram2[0][pcm.ram2[7][slot] & 31]; // 5
+                int sub_phase_of = (sub_phase >> 14) & 7;
+                if (pcm.nfs)
+                {
+                    pcm.ram2[8][slot] &= ~0x3fff;
+                    pcm.ram2[8][slot] |= sub_phase & 0x3fff;
+                }
 
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 15
-            b15 = b6 && (b15 ^ address_cmp); // 15
+                // address 0
+                int address_cnt = address;
+                int samp0 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 18
 
-            int samp2 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 1
+                cmp1 = address;
+                cmp2 = address_cnt;
+                int nibble_cmp2 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 8
+                cmp1 = b15 ? address_loop : address_end;
+                cmp2 = address_cnt;
+                int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
 
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp4 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 16
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 17
+                int next_address = address_cnt; // 11
+                int usenew = !nibble_cmp2;
+                int next_b15 = b15;
 
-            if (sub_phase_of >= 2)
-            {
-                next_address = address_cnt; // 17
-                usenew = !nibble_cmp4;
-                next_b15 = b15;
-            }
+                cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+                cmp2 = address_cnt;
+                int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+                int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+                int address_sub = !address_cmp && b6 && b15;
+                if (b7)
+                    address_cnt2 -= address_add - address_sub;
+                else
+                    address_cnt2 += address_add - address_sub;
+                address_cnt = address_cnt2 & 0xfffff; // 11
+                b15 = b6 && (b15 ^ address_cmp); // 11
 
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 19
-            b15 = b6 && (b15 ^ address_cmp); // 19
+                int samp1 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 20
 
-            int samp3 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 5
+                cmp1 = address;
+                cmp2 = address_cnt;
+                int nibble_cmp3 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 12
+                cmp1 = b15 ? address_loop : address_end;
+                cmp2 = address_cnt;
+                address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
 
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp5 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 20
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 21
+                if (sub_phase_of >= 1)
+                {
+                    next_address = address_cnt; // 13
+                    usenew = !nibble_cmp3;
+                    next_b15 = b15;
+                }
 
-            if (sub_phase_of >= 3)
-            {
-                next_address = address_cnt; // 21
-                usenew = !nibble_cmp5;
-                next_b15 = b15;
-            }
+                cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+                cmp2 = address_cnt;
+                address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+                address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+                address_sub = !address_cmp && b6 && b15;
+                if (b7)
+                    address_cnt2 -= address_add - address_sub;
+                else
+                    address_cnt2 += address_add - address_sub;
+                address_cnt = address_cnt2 & 0xfffff; // 15
+                b15 = b6 && (b15 ^ address_cmp); // 15
 
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 23
-            // b15 = b6 && (b15 ^ address_cmp); // 23
+                int samp2 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 1
 
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp6 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 24
+                cmp1 = address;
+                cmp2 = address_cnt;
+                int nibble_cmp4 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 16
+                cmp1 = b15 ? address_loop : address_end;
+                cmp2 = address_cnt;
+                address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 17
 
-            if (sub_phase_of >= 4)
-            {
-                next_address = address_cnt; // 1
-                usenew = !nibble_cmp6;
-                // b15 is not updated?
-            }
+                if (sub_phase_of >= 2)
+                {
+                    next_address = address_cnt; // 17
+                    usenew = !nibble_cmp4;
+                    next_b15 = b15;
+                }
 
-            if (active && pcm.nfs)
-                ram1[4] = next_address;
+                cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+                cmp2 = address_cnt;
+                address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-            if (pcm.nfs)
-            {
-                ram2[8] &= ~0x8000;
-                ram2[8] |= next_b15 << 15;
-            }
+                address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+                address_sub = !address_cmp && b6 && b15;
+                if (b7)
+                    address_cnt2 -= address_add - address_sub;
+                else
+                    address_cnt2 += address_add - address_sub;
+                address_cnt = address_cnt2 & 0xfffff; // 19
+                b15 = b6 && (b15 ^ address_cmp); // 19
 
-            // dpcm
+                int samp3 = (int8_t)PCM_ReadROM((hiaddr << 20) | address_cnt); // 5
 
-            // 18
-            int reference = ram1[5];
+                cmp1 = address;
+                cmp2 = address_cnt;
+                int nibble_cmp5 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 20
+                cmp1 = b15 ? address_loop : address_end;
+                cmp2 = address_cnt;
+                address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 21
 
-            // 19
-            int preshift = samp0 << 10;
-            int select_nibble = nibble_cmp2 ? old_nibble : newnibble;
-            int shift = (10 - select_nibble) & 15;
+                if (sub_phase_of >= 3)
+                {
+                    next_address = address_cnt; // 21
+                    usenew = !nibble_cmp5;
+                    next_b15 = b15;
+                }
 
-            int shifted = (preshift << 1) >> shift;
+                cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+                cmp2 = address_cnt;
+                address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
 
-            if (sub_phase_of >= 1)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
+                address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+                address_sub = !address_cmp && b6 && b15;
+                if (b7)
+                    address_cnt2 -= address_add - address_sub;
+                else
+                    address_cnt2 += address_add - address_sub;
+                address_cnt = address_cnt2 & 0xfffff; // 23
+                // b15 = b6 && (b15 ^ address_cmp); // 23
 
-            preshift = samp1 << 10;
-            select_nibble = nibble_cmp3 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
+                cmp1 = address;
+                cmp2 = address_cnt;
+                int nibble_cmp6 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 24
 
-            shifted = (preshift << 1) >> shift;
+                if (sub_phase_of >= 4)
+                {
+                    next_address = address_cnt; // 1
+                    usenew = !nibble_cmp6;
+                    // b15 is not updated?
+                }
 
-            if (sub_phase_of >= 2)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
+                if (active && pcm.nfs)
+                    pcm.ram1[4][slot] = next_address;
 
-            preshift = samp2 << 10;
-            select_nibble = nibble_cmp4 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
+                if (pcm.nfs)
+                {
+                    pcm.ram2[8][slot] &= ~0x8000;
+                    pcm.ram2[8][slot] |= next_b15 << 15;
+                }
 
-            shifted = (preshift << 1) >> shift;
+                // dpcm
 
-            if (sub_phase_of >= 3)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
+                // 18
+                int reference = pcm.ram1[5][slot];
 
-            preshift = samp3 << 10;
-            select_nibble = nibble_cmp5 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
+                // 19
+                int preshift = samp0 << 10;
+                int select_nibble = nibble_cmp2 ? old_nibble : newnibble;
+                int shift = (10 - select_nibble) & 15;
 
-            shifted = (preshift << 1) >> shift;
+                int shifted = (preshift << 1) >> shift;
 
-            if (sub_phase_of >= 4)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
+                if (sub_phase_of >= 1)
+                    reference = addclip20(reference, shifted >> 1, shifted & 1);
 
-            // interpolation
+                preshift = samp1 << 10;
+                select_nibble = nibble_cmp3 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
 
-            int test = ram1[5];
+                shifted = (preshift << 1) >> shift;
 
-            int step0 = multi(interp_lut[0][interp_ratio] << 6, samp0) >> 8;
-            select_nibble = nibble_cmp2 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step0 =  (step0 << 1) >> shift;
+                if (sub_phase_of >= 2)
+                    reference = addclip20(reference, shifted >> 1, shifted & 1);
 
-            test = addclip20(test, step0 >> 1, step0 & 1);
+                preshift = samp2 << 10;
+                select_nibble = nibble_cmp4 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
 
+                shifted = (preshift << 1) >> shift;
 
-            int step1 = multi(interp_lut[1][interp_ratio] << 6, samp1) >> 8;
-            select_nibble = nibble_cmp3 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step1 = (step1 << 1) >> shift;
+                if (sub_phase_of >= 3)
+                    reference = addclip20(reference, shifted >> 1, shifted & 1);
 
-            test = addclip20(test, step1 >> 1, step1 & 1);
+                preshift = samp3 << 10;
+                select_nibble = nibble_cmp5 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
 
-            int step2 = multi(interp_lut[2][interp_ratio] << 6, samp2) >> 8;
-            select_nibble = nibble_cmp4 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step2 = (step2 << 1) >> shift;
+                shifted = (preshift << 1) >> shift;
 
-            int reg1 = ram1[1];
-            int reg3 = ram1[3];
-            int reg2_6 = (ram2[6] >> 8) & 127;
+                if (sub_phase_of >= 4)
+                    reference = addclip20(reference, shifted >> 1, shifted & 1);
 
-            test = addclip20(test, step2 >> 1, step2 & 1);
+                // interpolation
 
-            int filter = ram2[11];
-            int v3;
+                int test = pcm.ram1[5][slot];
 
-            if (mcu->mcu_mk1)
-            {
-                int mult1 = multi(reg1, filter >> 8); // 8
-                int mult2 = multi(reg1, (filter >> 1) & 127); // 9
-                int mult3 = multi(reg1, reg2_6); // 10
+                int step0 = multi(interp_lut[0][interp_ratio] << 6, samp0) >> 8;
+                select_nibble = nibble_cmp2 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
+                step0 =  (step0 << 1) >> shift;
 
-                int v2 = addclip20(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
-                int v1 = addclip20(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
-                int subvar = addclip20(v1, (mult3 >> 6), (mult3 >> 5) & 1); // 11
+                test = addclip20(test, step0 >> 1, step0 & 1);
 
-                ram1[3] = v1;
 
-                v3 = addclip20(test, subvar ^ 0xfffff, 1); // 12
+                int step1 = multi(interp_lut[1][interp_ratio] << 6, samp1) >> 8;
+                select_nibble = nibble_cmp3 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
+                step1 = (step1 << 1) >> shift;
 
-                int mult4 = multi(v3, filter >> 8);
-                int mult5 = multi(v3, (filter >> 1) & 127);
-                int v4 = addclip20(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
-                int v5 = addclip20(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
+                test = addclip20(test, step1 >> 1, step1 & 1);
 
-                ram1[1] = v5;
-            }
-            else
-            {
-                // hack: use 32-bit math to avoid overflow
-                int mult1 = reg1 * (int8_t)(filter >> 8); // 8
-                int mult2 = reg1 * (int8_t)((filter >> 1) & 127); // 9
-                int mult3 = reg1 * (int8_t)reg2_6; // 10
+                int step2 = multi(interp_lut[2][interp_ratio] << 6, samp2) >> 8;
+                select_nibble = nibble_cmp4 ? old_nibble : newnibble;
+                shift = (10 - select_nibble) & 15;
+                step2 = (step2 << 1) >> shift;
 
-                int v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
-                int v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
-                int subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
+                int reg1 = pcm.ram1[1][slot];
+                int reg3 = pcm.ram1[3][slot];
+                int reg2_6 = (pcm.ram2[6][slot] >> 8) & 127;
 
-                ram1[3] = v1;
+                test = addclip20(test, step2 >> 1, step2 & 1);
 
-                int tests = test;
-                tests <<= 12;
-                tests >>= 12;
+                int filter = pcm.ram2[11][slot];
+                int v3;
 
-                v3 = tests - subvar; // 12
+                if (mcu->mcu_mk1)
+                {
+                    int mult1 = multi(reg1, filter >> 8); // 8
+                    int mult2 = multi(reg1, (filter >> 1) & 127); // 9
+                    int mult3 = multi(reg1, reg2_6); // 10
 
-                int mult4 = v3 * (int8_t)(filter >> 8);
-                int mult5 = v3 * (int8_t)((filter >> 1) & 127);
-                int v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
-                int v5 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
+                    int v2 = addclip20(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
+                    int v1 = addclip20(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
+                    int subvar = addclip20(v1, (mult3 >> 6), (mult3 >> 5) & 1); // 11
 
-                ram1[1] = v5;
-            }
+                    pcm.ram1[3][slot] = v1;
 
+                    v3 = addclip20(test, subvar ^ 0xfffff, 1); // 12
 
-            ram1[5] = reference;
+                    int mult4 = multi(v3, filter >> 8);
+                    int mult5 = multi(v3, (filter >> 1) & 127);
+                    int v4 = addclip20(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
+                    int v5 = addclip20(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
 
-            if (active && (ram2[6] & 1) != 0 && (ram2[8] & 0x4000) == 0 && !pcm.irq_assert && irq_flag)
-            {
-                //printf("irq voice %i\n", slot);
-                if (pcm.nfs)
-                    ram2[8] |= 0x4000;
-                pcm.irq_assert = 1;
-                pcm.irq_channel = slot;
-                if (mcu->mcu_jv880)
-                    mcu->MCU_GA_SetGAInt(5, 1);
+                    pcm.ram1[1][slot] = v5;
+                }
                 else
-                    MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_IRQ0, 1);
-            }
+                {
+                    // hack: use 32-bit math to avoid overflow
+                    int mult1 = reg1 * (int8_t)(filter >> 8); // 8
+                    int mult2 = reg1 * (int8_t)((filter >> 1) & 127); // 9
+                    int mult3 = reg1 * (int8_t)reg2_6; // 10
 
-            int volmul1 = 0;
-            int volmul2 = 0;
+                    int v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
+                    int v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
+                    int subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
 
-            calc_tv(&pcm, 0, ram2[3], &ram2[9], active, &volmul1);
-            calc_tv(&pcm, 1, ram2[4], &ram2[10], active, &volmul2);
-            calc_tv(&pcm, 2, ram2[5], &ram2[11], active, NULL);
+                    pcm.ram1[3][slot] = v1;
 
-            // if (volmul1 && volmul2)
-            //     volmul1 += 0;
+                    int tests = test;
+                    tests <<= 12;
+                    tests >>= 12;
 
-            int sample = (ram2[6] & 2) == 0 ? ram1[3] : v3;
-            //sample = test;
+                    v3 = tests - subvar; // 12
 
-            int multiv1 = multi(sample, volmul1 >> 8);
-            int multiv2 = multi(sample, (volmul1 >> 1) & 127);
+                    int mult4 = v3 * (int8_t)(filter >> 8);
+                    int mult5 = v3 * (int8_t)((filter >> 1) & 127);
+                    int v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
+                    int v5 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
 
-            int sample2 = addclip20(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
+                    pcm.ram1[1][slot] = v5;
+                }
 
-            int multiv3 = multi(sample2, volmul2 >> 8);
-            int multiv4 = multi(sample2, (volmul2 >> 1) & 127);
 
-            int sample3 = addclip20(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
+                pcm.ram1[5][slot] = reference;
 
-            int pan = active ? ram2[1] : 0;
-            int rc = active ? ram2[2] : 0;
+                if (active && (pcm.ram2[6][slot] & 1) != 0 && (pcm.ram2[8][slot] & 0x4000) == 0 && !pcm.irq_assert && irq_flag)
+                    PCM_SlotIRQ(slot);
 
-            int sampl = multi(sample3, (pan >> 8) & 255);
-            int sampr = multi(sample3, (pan >> 0) & 255);
+                int volmul1 = 0;
+                int volmul2 = 0;
 
-            int rc0 = multi(sample3, (rc >> 8) & 255) >> 5; // reverb
-            int rc1 = multi(sample3, (rc >> 0) & 255) >> 5; // chorus
-            
-            // mix reverb/chorus?
-            int slot2 = (slot == reg_slots - 1) ? 31 : slot + 1;
-            switch (slot2)
-            {
-                // 17, 18 - reverb
-
-                case 17:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[0] >> 1, rcadd[0] & 1);
-                    break;
-                case 18:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[1] >> 1, rcadd[1] & 1);
-                    break;
-                case 21:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[2] >> 1, rcadd[2] & 1);
-                    break;
-                case 22:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[3] >> 1, rcadd[3] & 1);
-                    break;
-                case 23:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[4] >> 1, rcadd[4] & 1);
-                    break;
-                case 31:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[5] >> 1, rcadd[5] & 1);
-                    break;
-            }
+                calc_tv(&pcm, 0, pcm.ram2[3][slot], &pcm.ram2[9][slot], active, &volmul1);
+                calc_tv(&pcm, 1, pcm.ram2[4][slot], &pcm.ram2[10][slot], active, &volmul2);
+                calc_tv(&pcm, 2, pcm.ram2[5][slot], &pcm.ram2[11][slot], active, NULL);
 
-            int suml = addclip20(pcm.ram1[31][1], sampl >> 6, (sampl >> 5) & 1);
-            int sumr = addclip20(pcm.ram1[31][3], sampr >> 6, (sampr >> 5) & 1);
+                // if (volmul1 && volmul2)
+                //     volmul1 += 0;
 
-            switch (slot2)
-            {
-                case 17:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
-                    break;
-                case 18:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
-                    break;
-                case 21:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
-                    break;
-                case 22:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
-                    break;
-                case 23:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
-                    break;
-                case 31:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
-                    break;
-            }
+                int sample = (pcm.ram2[6][slot] & 2) == 0 ? pcm.ram1[3][slot] : v3;
+                //sample = test;
 
-            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rc0 >> 1, rc0 & 1);
-            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rc1 >> 1, rc1 & 1);
+                int multiv1 = multi(sample, volmul1 >> 8);
+                int multiv2 = multi(sample, (volmul1 >> 1) & 127);
 
-            if (slot != reg_slots - 1)
-            {
-                pcm.ram1[31][1] = suml;
-                pcm.ram1[31][3] = sumr;
-            }
-            else
-            {
-                pcm.accum_l = suml;
-                pcm.accum_r = sumr;
-            }
+                int sample2 = addclip20(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
 
-            if (key && pcm.nfs)
-            {
-                ram2[7] &= ~0xf020;
-                ram2[7] |= ((usenew || kon) ? newnibble : old_nibble) << 12;
+                int multiv3 = multi(sample2, volmul2 >> 8);
+                int multiv4 = multi(sample2, (volmul2 >> 1) & 127);
 
-                // update key
-                ram2[7] |= key << 5;
-            }
+                int sample3 = addclip20(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
 
-            if (!active)
-            {
-                if (pcm.nfs)
+                int pan = active ? pcm.ram2[1][slot] : 0;
+                int rc = active ? pcm.ram2[2][slot] : 0;
+
+                int sampl = multi(sample3, (pan >> 8) & 255);
+                int sampr = multi(sample3, (pan >> 0) & 255);
+
+                int rc0 = multi(sample3, (rc >> 8) & 255) >> 5; // reverb
+                int rc1 = multi(sample3, (rc >> 0) & 255) >> 5; // chorus
+            
+                mix_slot(&pcm, slot, reg_slots, sampl, sampr, rc0, rc1, rcadd, rcadd2);
+
+                if (key && pcm.nfs)
                 {
-                    ram1[1] = 0;
-                    ram1[3] = 0;
-                    ram1[5] = 0;
+                    pcm.ram2[7][slot] &= ~0xf020;
+                    pcm.ram2[7][slot] |= ((usenew || kon) ? newnibble : old_nibble) << 12;
+
+                    // update key
+                    pcm.ram2[7][slot] |= key << 5;
                 }
 
-                ram2[8] = 0;
-                ram2[9] = 0;
-                ram2[10] = 0;
+                if (!active)
+                {
+                    if (pcm.nfs)
+                    {
+                        pcm.ram1[1][slot] = 0;
+                        pcm.ram1[3][slot] = 0;
+                        pcm.ram1[5][slot] = 0;
+                    }
+
+                    pcm.ram2[8][slot] = 0;
+                    pcm.ram2[9][slot] = 0;
+                    pcm.ram2[10][slot] = 0;
+                }
             }
         }
 
+        { // a slot that went through a whole frame keyed off is idle until
+          // it is keyed on or written to, see PCM_UpdateIdle
+            uint32_t slots = (1u << std::min(reg_slots, 28)) - 1;
+            pcm.voice_idle &= ~slots;
+            if (pcm.nfs && skip_idle)
+                pcm.voice_idle |= ~voice_active & slots;
+        }
+
         if (pcm.nfs)
         {
-            pcm.ram2[31][7] |= 0x20;
+            pcm.ram2[7][31] |= 0x20;
         }
 
         pcm.nfs = 1;
@@ -1439,3 +1925,72 @@ void Pcm::PCM_Update(uint64_t cycles)
         pcm.cycles += mcu->mcu_jv880 ? (cycles * 25) / 29 : cycles;
     }
 }
+
+// Publishes the state at the end of a block of count samples in the sample
+// buffer of the MCU. Audio thread only.
+void Pcm::PCM_PublishTelemetry(int count)
+{
+    pcm_telemetry_t &t = telemetry[telemetry_back];
+    int reg_slots = (pcm.config_reg_3d & 31) + 1;
+    uint32_t voice_active = pcm.voice_mask & pcm.voice_mask_pending & ((1u << std::min(reg_slots, 28)) - 1);
+
+    t.blocks = ++telemetry_blocks;
+    t.voice_active = voice_active;
+    t.active_slots = std::popcount(voice_active);
+    t.active_peak = std::max(pcm.active_peak, t.active_slots);
+    pcm.active_peak = 0;
+    for (int e = 0; e < 3; e++)
+        memcpy(t.level[e], pcm.ram2[9 + e], sizeof(t.level[e]));
+
+    int64_t peak[2] = {};
+    for (int i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 2; c++)
+        {
+            int64_t v = mcu->sample_buffer[i][c];
+            peak[c] = std::max(peak[c], v < 0 ? -v : v);
+        }
+    }
+    t.peak[0] = peak[0] * (1.0f / 2147483648.0f);
+    t.peak[1] = peak[1] * (1.0f / 2147483648.0f);
+
+    telemetry_back = telemetry_shared.exchange(telemetry_back | 4, std::memory_order_acq_rel) & 3;
+}
+
+// Copies the latest telemetry to out, returns false if nothing was
+// published since the last call. Lock-free, for one reader thread at a time.
+bool Pcm::PCM_GetTelemetry(pcm_telemetry_t *out)
+{
+    bool fresh = (telemetry_shared.load(std::memory_order_relaxed) & 4) != 0;
+    if (fresh)
+        telemetry_front = telemetry_shared.exchange(telemetry_front, std::memory_order_acq_rel) & 3;
+    *out = telemetry[telemetry_front];
+    return fresh;
+}
+
+// Stereo samples per frame: two with oversampling, see PCM_OUTPUT_*
+int Pcm::PCM_GetFrameSamples(void)
+{
+    return frame_samples;
+}
+
+// Called between host blocks. The host block was converted to frames, and
+// its MIDI positions to samples, at the rate of the frame samples, so a
+// write to config_reg_3c only switches them from the next block on.
+void Pcm::PCM_LatchOutput(void)
+{
+    if (output_mode == PCM_OUTPUT_SINGLE)
+        frame_samples = 1;
+    else if (output_mode == PCM_OUTPUT_CONFIG)
+        frame_samples = (pcm.config_reg_3c & 0x40) ? 2 : 1;
+    else
+        frame_samples = 2;
+}
+
+// Length of the frames PCM_Update would render with the current configuration
+uint64_t Pcm::PCM_GetFrameCycles(void)
+{
+    int reg_slots = (pcm.config_reg_3d & 31) + 1;
+    int cycles = (reg_slots + 1) * 25;
+    return mcu->mcu_jv880 ? (cycles * 25) / 29 : cycles;
+}
@@ -33,10 +33,21 @@
  */
 #pragma once
 #include <stdint.h>
+#include <atomic>
+
+// Longest frame, 32 slots at the SC-55 rate
+static const uint64_t PCM_MAX_FRAME_CYCLES = 33 * 25;
+
+// Reverb/chorus delay memory, 16-bit words
+static const int PCM_ERAM_SIZE = 0x4000;
+
+// Wave rom address space, 8 banks of 2 MB selected by bits 21-23
+static const int PCM_WAVEROM_BANK_SIZE = 0x200000;
 
 struct pcm_t {
-    uint32_t ram1[32][8];
-    uint16_t ram2[32][16];
+    // register-major, [register][slot]
+    uint32_t ram1[8][32];
+    uint16_t ram2[16][32];
     uint32_t select_channel;
     uint32_t voice_mask;
     uint32_t voice_mask_pending;
@@ -49,6 +60,8 @@ struct pcm_t {
     uint8_t config_reg_3d;
     uint32_t irq_channel;
     uint32_t irq_assert;
+    uint32_t voice_idle; // keyed off slots whose state stopped changing
+    int active_peak; // most voice slots keyed on at once since the last telemetry
 
     uint32_t nfs;
 
@@ -56,13 +69,45 @@ struct pcm_t {
 
     uint64_t cycles;
 
-    uint16_t eram[0x4000];
+    uint16_t eram[PCM_ERAM_SIZE];
+    uint32_t eram_heard; // eram words read or written by the frame, ORed
+    uint32_t effects_quiet; // frames in a row the delay line code read and wrote only zeros
 
     int accum_l;
     int accum_r;
     int rcsum[2];
 };
 
+enum {
+    PCM_ENGINE_SERIAL = 0, // one slot after the other
+    PCM_ENGINE_VECTOR // several slots at a time in SIMD lanes, see pcm_lanes.h
+};
+
+enum {
+    PCM_OUTPUT_OVERSAMPLED = 0, // two samples per frame, 64 kHz
+    PCM_OUTPUT_CONFIG, // oversampled if set in config_reg_3c, as the chip does
+    PCM_OUTPUT_SINGLE // one sample per frame, 32 kHz, for dense sessions
+};
+
+// Per-slot results of the vector engine, mixed in slot order afterwards
+struct pcm_slot_mix_t {
+    int32_t sampl[32];
+    int32_t sampr[32];
+    int32_t rc0[32];
+    int32_t rc1[32];
+    int32_t irq[32];
+};
+
+// Published once per rendered block, see PCM_GetTelemetry
+struct pcm_telemetry_t {
+    uint32_t blocks; // published so far
+    uint32_t voice_active; // voice slots keyed on at the end of the block
+    int active_slots; // of the 28
+    int active_peak; // most at once during the block
+    uint16_t level[3][28]; // ram2[9 + e] of the voice slots: two amplitude envelopes, filter
+    float peak[2]; // largest output magnitude of the block, 1.0 is full scale
+};
+
 struct MCU;
 
 struct Pcm {
@@ -70,15 +115,46 @@ struct Pcm {
     Pcm(MCU *mcu);
 
     pcm_t pcm = {0};
+    int engine = PCM_ENGINE_SERIAL;
+    int output_mode = PCM_OUTPUT_OVERSAMPLED;
+    int frame_samples = 2; // for output_mode, latched by PCM_LatchOutput
+    // off, every slot and the delay line code run each frame, for checking
+    // that skipping the idle ones changes nothing
+    bool skip_idle = true;
     uint8_t waverom1[0x200000];
     uint8_t waverom2[0x200000];
     uint8_t waverom3[0x100000];
     uint8_t waverom_card[0x200000];
     uint8_t waverom_exp[0x800000];
+    const uint8_t *waverom_banks[8]; // 1, 2, card, 4 expansion banks, unmapped
+
+    // triple buffer, the audio thread fills telemetry[telemetry_back] and
+    // swaps it with the shared one, the reader swaps that with
+    // telemetry[telemetry_front]. Bit 2 of telemetry_shared is set while
+    // the shared one is newer than the reader's.
+    pcm_telemetry_t telemetry[3] = {};
+    int telemetry_back = 0;
+    int telemetry_front = 1;
+    std::atomic<int> telemetry_shared{2};
+    uint32_t telemetry_blocks = 0;
 
     void PCM_Write(uint32_t address, uint8_t data);
     uint8_t PCM_Read(uint32_t address);
     void PCM_Reset(void);
     void PCM_Update(uint64_t cycles);
+    void PCM_RenderFrames(int frames, int32_t *out);
+    uint64_t PCM_GetFrameCycles(void);
+    int PCM_GetFrameSamples(void);
+    void PCM_LatchOutput(void);
     uint8_t PCM_ReadROM(uint32_t address);
+    void PCM_SetExpansion(const uint8_t *exp);
+    void PCM_PublishTelemetry(int count);
+    bool PCM_GetTelemetry(pcm_telemetry_t *out);
+    void PCM_SlotIRQ(int slot);
+    void PCM_UpdateEffects(int *rcadd, int *rcadd2);
+    void PCM_UpdateIdle(int slot, pcm_slot_mix_t *mix);
+    template <typename L>
+    void PCM_UpdateLanes(int slot, int voice_active, pcm_slot_mix_t *mix);
+    template <typename L>
+    void PCM_UpdateGroup(int slot, uint32_t awake, int voice_active, pcm_slot_mix_t *mix);
 };
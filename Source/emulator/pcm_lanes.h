@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#include <stdint.h>
+
+// Lanes of 32-bit integers for the vector slot engine in PCM_Update.
+// Every type has the same interface: conditions are masks with all bits
+// of a lane set or clear, sra() shifts each lane by its own count (0-15).
+// AVX2 is used when the build targets it, SSE2 on any x86-64 build and
+// single lanes everywhere else. Defining PCM_NO_SIMD forces single lanes.
+
+#if !defined(PCM_NO_SIMD) && defined(__AVX2__)
+#define PCM_LANES_AVX2 1
+#endif
+#if !defined(PCM_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PCM_LANES_SSE2 1
+#endif
+
+#if defined(PCM_LANES_AVX2) || defined(PCM_LANES_SSE2)
+#include <immintrin.h>
+#endif
+
+struct pcm_lanes_1 {
+    static const int width = 1;
+    int32_t v;
+
+    pcm_lanes_1() {}
+    pcm_lanes_1(int32_t x): v(x) {}
+
+    static pcm_lanes_1 load(const uint32_t *p) { return (int32_t)*p; }
+    static pcm_lanes_1 load(const uint16_t *p) { return (int32_t)*p; }
+    static pcm_lanes_1 load(const int32_t *p) { return *p; }
+    void store(uint32_t *p) const { *p = v; }
+    void store(uint16_t *p) const { *p = (uint16_t)v; }
+    void store(int32_t *p) const { *p = v; }
+    static pcm_lanes_1 bits(void) { return 1; } // 1 << lane
+
+    friend pcm_lanes_1 operator+(pcm_lanes_1 a, pcm_lanes_1 b) { return (int32_t)((uint32_t)a.v + (uint32_t)b.v); }
+    friend pcm_lanes_1 operator-(pcm_lanes_1 a, pcm_lanes_1 b) { return (int32_t)((uint32_t)a.v - (uint32_t)b.v); }
+    friend pcm_lanes_1 operator&(pcm_lanes_1 a, pcm_lanes_1 b) { return a.v & b.v; }
+    friend pcm_lanes_1 operator|(pcm_lanes_1 a, pcm_lanes_1 b) { return a.v | b.v; }
+    friend pcm_lanes_1 operator^(pcm_lanes_1 a, pcm_lanes_1 b) { return a.v ^ b.v; }
+    pcm_lanes_1 operator~() const { return ~v; }
+    pcm_lanes_1 operator<<(int n) const { return (int32_t)((uint32_t)v << n); }
+    pcm_lanes_1 operator>>(int n) const { return v >> n; }
+
+    friend pcm_lanes_1 mul(pcm_lanes_1 a, pcm_lanes_1 b) { return (int32_t)((uint32_t)a.v * (uint32_t)b.v); }
+    friend pcm_lanes_1 sra(pcm_lanes_1 a, pcm_lanes_1 n) { return a.v >> n.v; }
+    friend pcm_lanes_1 eq(pcm_lanes_1 a, pcm_lanes_1 b) { return a.v == b.v ? -1 : 0; }
+    friend pcm_lanes_1 gt(pcm_lanes_1 a, pcm_lanes_1 b) { return a.v > b.v ? -1 : 0; }
+    friend pcm_lanes_1 select(pcm_lanes_1 m, pcm_lanes_1 a, pcm_lanes_1 b) { return m.v ? a : b; }
+    friend pcm_lanes_1 gather(const int32_t *table, pcm_lanes_1 i) { return table[i.v]; }
+    friend pcm_lanes_1 gather(const uint16_t *table, pcm_lanes_1 i) { return table[i.v]; }
+};
+
+#ifdef PCM_LANES_SSE2
+struct pcm_lanes_4 {
+    static const int width = 4;
+    __m128i v;
+
+    pcm_lanes_4() {}
+    pcm_lanes_4(__m128i x): v(x) {}
+    pcm_lanes_4(int32_t x): v(_mm_set1_epi32(x)) {}
+
+    static pcm_lanes_4 load(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+    static pcm_lanes_4 load(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+    static pcm_lanes_4 load(const uint16_t *p)
+    {
+        return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128());
+    }
+    void store(uint32_t *p) const { _mm_storeu_si128((__m128i *)p, v); }
+    void store(int32_t *p) const { _mm_storeu_si128((__m128i *)p, v); }
+    void store(uint16_t *p) const
+    {
+        // sign extend the low halves so the saturating pack truncates
+        __m128i x = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        _mm_storel_epi64((__m128i *)p, _mm_packs_epi32(x, x));
+    }
+    static pcm_lanes_4 bits(void) { return _mm_setr_epi32(1, 2, 4, 8); }
+
+    friend pcm_lanes_4 operator+(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_add_epi32(a.v, b.v); }
+    friend pcm_lanes_4 operator-(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_sub_epi32(a.v, b.v); }
+    friend pcm_lanes_4 operator&(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_and_si128(a.v, b.v); }
+    friend pcm_lanes_4 operator|(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_or_si128(a.v, b.v); }
+    friend pcm_lanes_4 operator^(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_xor_si128(a.v, b.v); }
+    pcm_lanes_4 operator~() const { return _mm_xor_si128(v, _mm_set1_epi32(-1)); }
+    pcm_lanes_4 operator<<(int n) const { return _mm_sll_epi32(v, _mm_cvtsi32_si128(n)); }
+    pcm_lanes_4 operator>>(int n) const { return _mm_sra_epi32(v, _mm_cvtsi32_si128(n)); }
+
+    friend pcm_lanes_4 mul(pcm_lanes_4 a, pcm_lanes_4 b)
+    {
+#ifdef __SSE4_1__
+        return _mm_mullo_epi32(a.v, b.v);
+#else
+        __m128i even = _mm_mul_epu32(a.v, b.v);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+    }
+    friend pcm_lanes_4 select(pcm_lanes_4 m, pcm_lanes_4 a, pcm_lanes_4 b)
+    {
+        return _mm_or_si128(_mm_and_si128(m.v, a.v), _mm_andnot_si128(m.v, b.v));
+    }
+    friend pcm_lanes_4 eq(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_cmpeq_epi32(a.v, b.v); }
+    friend pcm_lanes_4 gt(pcm_lanes_4 a, pcm_lanes_4 b) { return _mm_cmpgt_epi32(a.v, b.v); }
+    friend pcm_lanes_4 sra(pcm_lanes_4 a, pcm_lanes_4 n)
+    {
+        // one conditional shift per bit of the count
+        pcm_lanes_4 zero = _mm_setzero_si128();
+        a = select(eq(n & 1, zero), a, a >> 1);
+        a = select(eq(n & 2, zero), a, a >> 2);
+        a = select(eq(n & 4, zero), a, a >> 4);
+        a = select(eq(n & 8, zero), a, a >> 8);
+        return a;
+    }
+    friend pcm_lanes_4 gather(const int32_t *table, pcm_lanes_4 i)
+    {
+        alignas(16) int32_t ix[4];
+        _mm_store_si128((__m128i *)ix, i.v);
+        return _mm_setr_epi32(table[ix[0]], table[ix[1]], table[ix[2]], table[ix[3]]);
+    }
+    friend pcm_lanes_4 gather(const uint16_t *table, pcm_lanes_4 i)
+    {
+        alignas(16) int32_t ix[4];
+        _mm_store_si128((__m128i *)ix, i.v);
+        return _mm_setr_epi32(table[ix[0]], table[ix[1]], table[ix[2]], table[ix[3]]);
+    }
+};
+#endif
+
+#ifdef PCM_LANES_AVX2
+struct pcm_lanes_8 {
+    static const int width = 8;
+    __m256i v;
+
+    pcm_lanes_8() {}
+    pcm_lanes_8(__m256i x): v(x) {}
+    pcm_lanes_8(int32_t x): v(_mm256_set1_epi32(x)) {}
+
+    static pcm_lanes_8 load(const uint32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+    static pcm_lanes_8 load(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+    static pcm_lanes_8 load(const uint16_t *p)
+    {
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+    }
+    void store(uint32_t *p) const { _mm256_storeu_si256((__m256i *)p, v); }
+    void store(int32_t *p) const { _mm256_storeu_si256((__m256i *)p, v); }
+    void store(uint16_t *p) const
+    {
+        __m256i x = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+        _mm_storeu_si128((__m128i *)p, packed);
+    }
+    static pcm_lanes_8 bits(void) { return _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128); }
+
+    friend pcm_lanes_8 operator+(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_add_epi32(a.v, b.v); }
+    friend pcm_lanes_8 operator-(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_sub_epi32(a.v, b.v); }
+    friend pcm_lanes_8 operator&(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_and_si256(a.v, b.v); }
+    friend pcm_lanes_8 operator|(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_or_si256(a.v, b.v); }
+    friend pcm_lanes_8 operator^(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_xor_si256(a.v, b.v); }
+    pcm_lanes_8 operator~() const { return _mm256_xor_si256(v, _mm256_set1_epi32(-1)); }
+    pcm_lanes_8 operator<<(int n) const { return _mm256_sll_epi32(v, _mm_cvtsi32_si128(n)); }
+    pcm_lanes_8 operator>>(int n) const { return _mm256_sra_epi32(v, _mm_cvtsi32_si128(n)); }
+
+    friend pcm_lanes_8 mul(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_mullo_epi32(a.v, b.v); }
+    friend pcm_lanes_8 sra(pcm_lanes_8 a, pcm_lanes_8 n) { return _mm256_srav_epi32(a.v, n.v); }
+    friend pcm_lanes_8 eq(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_cmpeq_epi32(a.v, b.v); }
+    friend pcm_lanes_8 gt(pcm_lanes_8 a, pcm_lanes_8 b) { return _mm256_cmpgt_epi32(a.v, b.v); }
+    friend pcm_lanes_8 select(pcm_lanes_8 m, pcm_lanes_8 a, pcm_lanes_8 b)
+    {
+        return _mm256_blendv_epi8(b.v, a.v, m.v);
+    }
+    friend pcm_lanes_8 gather(const int32_t *table, pcm_lanes_8 i)
+    {
+        return _mm256_i32gather_epi32((const int *)table, i.v, 4);
+    }
+    friend pcm_lanes_8 gather(const uint16_t *table, pcm_lanes_8 i)
+    {
+        alignas(32) int32_t ix[8];
+        _mm256_store_si256((__m256i *)ix, i.v);
+        return _mm256_setr_epi32(table[ix[0]], table[ix[1]], table[ix[2]], table[ix[3]],
+            table[ix[4]], table[ix[5]], table[ix[6]], table[ix[7]]);
+    }
+};
+#endif
@@ -11,6 +11,9 @@
 #include <JuceHeader.h>
 #include "SettingsTab.h"
 
+// render-ahead latencies in frames, the box ids are the index + 1
+static const int renderAheadLatencies[] = { 0, 256, 512, 1024, 2048, 4096 };
+
 //==============================================================================
 SettingsTab::SettingsTab(Jv880_juceAudioProcessor& p) : audioProcessor (p)
 {
@@ -37,6 +40,35 @@ SettingsTab::SettingsTab(Jv880_juceAudioProcessor& p) : audioProcessor (p)
     addAndMakeVisible (chorusToggle);
     chorusToggle.addListener (this);
     chorusToggle.setButtonText ("Chorus Enabled");
+
+    // ids are the RESAMPLER_QUALITY_* values + 1
+    addAndMakeVisible (resamplerQualityBox);
+    resamplerQualityBox.addItem ("Draft", RESAMPLER_QUALITY_DRAFT + 1);
+    resamplerQualityBox.addItem ("Normal", RESAMPLER_QUALITY_NORMAL + 1);
+    resamplerQualityBox.addItem ("Mastering", RESAMPLER_QUALITY_MASTERING + 1);
+    resamplerQualityBox.addListener (this);
+    addAndMakeVisible (resamplerQualityLabel);
+    resamplerQualityLabel.setText ("Resampler", juce::dontSendNotification);
+    resamplerQualityLabel.attachToComponent (&resamplerQualityBox, true);
+
+    addAndMakeVisible (renderAheadBox);
+    renderAheadBox.addItem ("Off", 1);
+    for (int i = 1; i < (int)std::size (renderAheadLatencies); i++)
+      renderAheadBox.addItem (juce::String (renderAheadLatencies[i]) + " samples", i + 1);
+    renderAheadBox.addListener (this);
+    addAndMakeVisible (renderAheadLabel);
+    renderAheadLabel.setText ("Render Ahead", juce::dontSendNotification);
+    renderAheadLabel.attachToComponent (&renderAheadBox, true);
+
+    // ids are the PCM_OUTPUT_* values + 1
+    addAndMakeVisible (pcmOutputBox);
+    pcmOutputBox.addItem ("64 kHz", PCM_OUTPUT_OVERSAMPLED + 1);
+    pcmOutputBox.addItem ("As configured", PCM_OUTPUT_CONFIG + 1);
+    pcmOutputBox.addItem ("32 kHz", PCM_OUTPUT_SINGLE + 1);
+    pcmOutputBox.addListener (this);
+    addAndMakeVisible (pcmOutputLabel);
+    pcmOutputLabel.setText ("PCM Output", juce::dontSendNotification);
+    pcmOutputLabel.attachToComponent (&pcmOutputBox, true);
 }
 
 SettingsTab::~SettingsTab()
@@ -48,6 +80,12 @@ void SettingsTab::visibilityChanged()
     masterTuneSlider.setValue (((int8_t*)audioProcessor.mcu->nvram)[0x00] + 64, juce::dontSendNotification);
     reverbToggle.setToggleState (((audioProcessor.mcu->nvram[0x02] >> 0) & 1) == 1, juce::dontSendNotification);
     chorusToggle.setToggleState (((audioProcessor.mcu->nvram[0x02] >> 1) & 1) == 1, juce::dontSendNotification);
+    resamplerQualityBox.setSelectedId (audioProcessor.status.resamplerQuality + 1, juce::dontSendNotification);
+    renderAheadBox.setSelectedId (0, juce::dontSendNotification);
+    for (int i = 0; i < (int)std::size (renderAheadLatencies); i++)
+      if (renderAheadLatencies[i] == audioProcessor.status.renderAheadLatency)
+        renderAheadBox.setSelectedId (i + 1, juce::dontSendNotification);
+    pcmOutputBox.setSelectedId (audioProcessor.status.pcmOutputMode + 1, juce::dontSendNotification);
 }
 
 void SettingsTab::resized()
@@ -56,6 +94,9 @@ void SettingsTab::resized()
     masterTuneSlider.setBounds (sliderLeft, 40, getWidth() - sliderLeft - 10, 40);
     reverbToggle.setBounds (sliderLeft, 100, 200, 40);
     chorusToggle.setBounds (sliderLeft, 140, 200, 40);
+    resamplerQualityBox.setBounds (sliderLeft, 190, 200, 30);
+    renderAheadBox.setBounds (sliderLeft, 230, 200, 30);
+    pcmOutputBox.setBounds (sliderLeft, 270, 200, 30);
 }
 
 void SettingsTab::sliderValueChanged (juce::Slider* slider)
@@ -84,3 +125,20 @@ void SettingsTab::buttonClicked (juce::Button* button)
 void SettingsTab::buttonStateChanged (juce::Button* button)
 {
 }
+
+void SettingsTab::comboBoxChanged (juce::ComboBox* comboBox)
+{
+    // used for live playback, offline renders always use mastering. When
+    // rendering ahead it applies from the next prepareToPlay
+    if (comboBox == &resamplerQualityBox) {
+      audioProcessor.status.resamplerQuality = resamplerQualityBox.getSelectedId() - 1;
+    }
+    // the latency changes when the host next calls prepareToPlay
+    if (comboBox == &renderAheadBox && renderAheadBox.getSelectedId() > 0) {
+      audioProcessor.status.renderAheadLatency = renderAheadLatencies[renderAheadBox.getSelectedId() - 1];
+    }
+    // so does the output rate, the resamplers are set up for it there
+    if (comboBox == &pcmOutputBox && pcmOutputBox.getSelectedId() > 0) {
+      audioProcessor.status.pcmOutputMode = pcmOutputBox.getSelectedId() - 1;
+    }
+}
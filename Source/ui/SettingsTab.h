@@ -16,7 +16,7 @@
 //==============================================================================
 /*
 */
-class SettingsTab  : public juce::Component, public juce::Slider::Listener, public juce::Button::Listener
+class SettingsTab  : public juce::Component, public juce::Slider::Listener, public juce::Button::Listener, public juce::ComboBox::Listener
 {
 public:
     SettingsTab(Jv880_juceAudioProcessor&);
@@ -27,6 +27,7 @@ public:
     void sliderValueChanged (juce::Slider*) override;
     void buttonClicked (juce::Button*) override;
     void buttonStateChanged (juce::Button*) override;
+    void comboBoxChanged (juce::ComboBox*) override;
 
 private:
     Jv880_juceAudioProcessor& audioProcessor;
@@ -35,6 +36,12 @@ private:
     juce::Label masterTuneLabel;
     juce::ToggleButton reverbToggle;
     juce::ToggleButton chorusToggle;
+    juce::ComboBox resamplerQualityBox;
+    juce::Label resamplerQualityLabel;
+    juce::ComboBox renderAheadBox;
+    juce::Label renderAheadLabel;
+    juce::ComboBox pcmOutputBox;
+    juce::Label pcmOutputLabel;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SettingsTab)
 };
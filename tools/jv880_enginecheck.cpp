@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Checks that the alternative engines render the same audio. Runs the
+// firmware twice, once with MCU_ENGINE_POLLING and once with
+// MCU_ENGINE_SCHEDULED, or with -p once with PCM_ENGINE_SERIAL and once
+// with PCM_ENGINE_VECTOR. With -i it runs once with Pcm::skip_idle off and
+// once with it on, on PCM_ENGINE_VECTOR, or on PCM_ENGINE_SERIAL when -p
+// is given as well. Plays the same MIDI script into both in blocks of
+// varying size and compares the PCM samples and the resampled output of
+// every block bit for bit. Stops with exit code 1 at the first sample that
+// differs.
+//
+// Build from the repository root, as one command:
+//   g++ -std=c++20 -O2 -DMCU_ROMSET=ROM_SET_JV880 -ISource/emulator
+//       tools/jv880_enginecheck.cpp Source/emulator/*.cpp Source/emulator/resample/*.c
+//       -o jv880_enginecheck
+// The vector engine uses AVX2 lanes when built with -mavx2, SSE2 lanes on
+// other x86-64 builds and single lanes with -DPCM_NO_SIMD, check each.
+//
+// Usage: jv880_enginecheck <rom directory> [-p] [-i] [-s seconds] [-r rate]
+//        jv880_enginecheck -t seed [-p] [-i] [-s seconds] [-r rate]
+// The directory holds jv880_rom1.bin, jv880_rom2.bin, jv880_waverom1.bin,
+// jv880_waverom2.bin and jv880_nvram.bin. With -t the ROMs are random
+// data from the seed, with the vectors pointing into the program rom and
+// random voices keyed on. That isn't music, but it runs through most
+// instructions and voice states without the real ROMs. Its effects never
+// go quiet though, -i needs the real ROMs to check the delay line bypass.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcu.h"
+
+static char *LoadFile(const char *dir, const char *name, size_t size)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        printf("Cannot open %s\n", path);
+        return nullptr;
+    }
+    char *data = (char *)calloc(1, size);
+    if (fread(data, 1, size, f) != size)
+        printf("%s is shorter than expected\n", path);
+    fclose(f);
+    return data;
+}
+
+static uint32_t random_state;
+
+static uint32_t Random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static char *RandomImage(size_t size)
+{
+    char *data = (char *)malloc(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = (char)Random();
+    return data;
+}
+
+static void RandomVoices(MCU *mcu, uint32_t seed)
+{
+    pcm_t &pcm = mcu->pcm.pcm;
+    random_state = seed;
+    for (int slot = 0; slot < 32; slot++)
+    {
+        for (int i = 0; i < 8; i++)
+            pcm.ram1[i][slot] = Random() & 0xfffff;
+        for (int i = 0; i < 16; i++)
+            pcm.ram2[i][slot] = (uint16_t)Random();
+    }
+    pcm.config_reg_3d = 27;
+    pcm.voice_mask = pcm.voice_mask_pending = Random() & 0xfffffff;
+}
+
+// Chords at changing positions inside the blocks, a modulation sweep and
+// pitch bends
+static void PlayScript(MCU *mcu, int block_index, int frames, int rate)
+{
+    static const uint8_t notes[] = { 48, 55, 60, 64, 67 };
+    int pos = (block_index * 97) % frames * mcu->MCU_GetSampleRate() / rate;
+
+    if (block_index % 8 == 0)
+    {
+        uint8_t status = (block_index / 8) % 2 ? 0x80 : 0x90;
+        for (uint8_t note : notes)
+        {
+            uint8_t message[3] = { status, (uint8_t)(note + (block_index / 16) % 12), 100 };
+            mcu->enqueueMidiSC55(message, 3, pos);
+        }
+    }
+    if (block_index % 4 == 2)
+    {
+        uint8_t message[3] = { 0xb0, 1, (uint8_t)(block_index % 128) };
+        mcu->enqueueMidiSC55(message, 3, pos);
+    }
+    if (block_index % 16 == 5)
+    {
+        uint8_t message[3] = { 0xe0, 0, (uint8_t)((block_index * 13) % 128) };
+        mcu->enqueueMidiSC55(message, 3, pos);
+    }
+}
+
+// Returns false and reports the first difference
+static bool CompareBlock(MCU *a, MCU *b, int block_index, const float *out_a, const float *out_b, int frames)
+{
+    if (a->sample_write_ptr != b->sample_write_ptr)
+    {
+        printf("block %d: %d and %d samples rendered\n", block_index, a->sample_write_ptr, b->sample_write_ptr);
+        return false;
+    }
+    for (int i = 0; i < a->sample_write_ptr; i++)
+    {
+        if (a->sample_buffer[i][0] != b->sample_buffer[i][0] || a->sample_buffer[i][1] != b->sample_buffer[i][1])
+        {
+            printf("block %d sample %d: %d %d and %d %d\n", block_index, i,
+                a->sample_buffer[i][0], a->sample_buffer[i][1], b->sample_buffer[i][0], b->sample_buffer[i][1]);
+            return false;
+        }
+    }
+    if (memcmp(out_a, out_b, frames * 2 * sizeof(float)))
+    {
+        printf("block %d: the resampled output differs\n", block_index);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = nullptr;
+    bool synthetic = false;
+    bool pcm_engines = false;
+    bool idle_skips = false;
+    uint32_t seed = 1;
+    int seconds = 10;
+    int rate = 48000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rate = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-p"))
+            pcm_engines = true;
+        else if (!strcmp(argv[i], "-i"))
+            idle_skips = true;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            synthetic = true;
+            seed = (uint32_t)atoi(argv[++i]) * 2654435761u + 1;
+        }
+        else
+            dir = argv[i];
+    }
+    if (!dir && !synthetic)
+    {
+        printf("Usage: %s <rom directory> | -t seed [-p] [-i] [-s seconds] [-r rate]\n", argv[0]);
+        return 1;
+    }
+
+    char *rom1, *rom2, *waverom1, *waverom2, *nvram;
+    if (synthetic)
+    {
+        random_state = seed;
+        rom1 = RandomImage(ROM1_SIZE);
+        rom2 = RandomImage(ROM2_SIZE);
+        waverom1 = RandomImage(0x200000);
+        waverom2 = RandomImage(0x200000);
+        nvram = RandomImage(NVRAM_SIZE);
+        for (int v = 0; v < 64; v++)
+        {
+            uint32_t address = 0x1000 + Random() % 0x6000;
+            rom1[v * 4 + 0] = 0;
+            rom1[v * 4 + 1] = 0;
+            rom1[v * 4 + 2] = (char)(address >> 8);
+            rom1[v * 4 + 3] = (char)address;
+        }
+    }
+    else
+    {
+        rom1 = LoadFile(dir, "jv880_rom1.bin", ROM1_SIZE);
+        rom2 = LoadFile(dir, "jv880_rom2.bin", ROM2_SIZE_JV880);
+        waverom1 = LoadFile(dir, "jv880_waverom1.bin", 0x200000);
+        waverom2 = LoadFile(dir, "jv880_waverom2.bin", 0x200000);
+        nvram = LoadFile(dir, "jv880_nvram.bin", NVRAM_SIZE);
+        if (!rom1 || !rom2 || !waverom1 || !waverom2 || !nvram)
+            return 1;
+    }
+
+    MCU *mcu[2];
+    for (int i = 0; i < 2; i++)
+    {
+        mcu[i] = new MCU();
+        mcu[i]->startSC55(rom1, rom2, waverom1, waverom2, nvram);
+        if (synthetic)
+            RandomVoices(mcu[i], seed);
+    }
+    if (idle_skips)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            mcu[i]->engine_mode = MCU_ENGINE_SCHEDULED;
+            mcu[i]->pcm.engine = pcm_engines ? PCM_ENGINE_SERIAL : PCM_ENGINE_VECTOR;
+        }
+        mcu[0]->pcm.skip_idle = false;
+    }
+    else if (pcm_engines)
+    {
+        for (int i = 0; i < 2; i++)
+            mcu[i]->engine_mode = MCU_ENGINE_SCHEDULED;
+        mcu[0]->pcm.engine = PCM_ENGINE_SERIAL;
+        mcu[1]->pcm.engine = PCM_ENGINE_VECTOR;
+    }
+    else
+    {
+        for (int i = 0; i < 2; i++)
+            mcu[i]->pcm.engine = PCM_ENGINE_VECTOR;
+        mcu[0]->engine_mode = MCU_ENGINE_POLLING;
+        mcu[1]->engine_mode = MCU_ENGINE_SCHEDULED;
+    }
+
+    static const int block_sizes[] = { 512, 480, 64, 1024, 257, 128 };
+    static float out[2][1024 * 2];
+    int blocks = 0;
+    long long frames_total = 0;
+    bool same = true;
+
+    while (same && frames_total < (long long)rate * seconds)
+    {
+        int frames = block_sizes[blocks % (sizeof(block_sizes) / sizeof(block_sizes[0]))];
+        for (int i = 0; i < 2; i++)
+        {
+            PlayScript(mcu[i], blocks, frames, rate);
+            mcu[i]->updateSC55WithSampleRate(out[i], out[i] + frames, frames, rate);
+        }
+        same = CompareBlock(mcu[0], mcu[1], blocks, out[0], out[1], frames);
+        blocks++;
+        frames_total += frames;
+    }
+
+    if (same)
+        printf("identical, %d blocks, %lld frames\n", blocks, frames_total);
+
+    delete mcu[0];
+    delete mcu[1];
+    free(rom1);
+    free(rom2);
+    free(waverom1);
+    free(waverom2);
+    free(nvram);
+    return same ? 0 : 1;
+}
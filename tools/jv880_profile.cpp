@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Headless firmware profiler. Runs the JV-880 firmware without the plugin,
+// plays a short note pattern and writes the MCU profile to stdout or a file.
+//
+// Build from the repository root, as one command:
+//   g++ -std=c++20 -O2 -DMCU_PROFILER -DMCU_ROMSET=ROM_SET_JV880 -ISource/emulator
+//       tools/jv880_profile.cpp Source/emulator/*.cpp Source/emulator/resample/*.c
+//       -o jv880_profile
+//
+// Usage: jv880_profile <rom directory> [-s seconds] [-n addresses] [-r rate] [-c] [-o file]
+// The directory holds jv880_rom1.bin, jv880_rom2.bin, jv880_waverom1.bin,
+// jv880_waverom2.bin and jv880_nvram.bin.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcu.h"
+
+static char *LoadFile(const char *dir, const char *name, size_t size)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        printf("Cannot open %s\n", path);
+        return nullptr;
+    }
+    char *data = (char *)calloc(1, size);
+    if (fread(data, 1, size, f) != size)
+        printf("%s is shorter than expected\n", path);
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = nullptr;
+    int seconds = 10;
+    int max_addresses = 50;
+    int rate = 48000;
+    int format = PROFILER_REPORT_TEXT;
+    const char *output = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            max_addresses = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rate = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))
+            format = PROFILER_REPORT_CSV;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else
+            dir = argv[i];
+    }
+    if (!dir)
+    {
+        printf("Usage: %s <rom directory> [-s seconds] [-n addresses] [-r rate] [-c] [-o file]\n", argv[0]);
+        return 1;
+    }
+
+    char *rom1 = LoadFile(dir, "jv880_rom1.bin", ROM1_SIZE);
+    char *rom2 = LoadFile(dir, "jv880_rom2.bin", ROM2_SIZE_JV880);
+    char *waverom1 = LoadFile(dir, "jv880_waverom1.bin", 0x200000);
+    char *waverom2 = LoadFile(dir, "jv880_waverom2.bin", 0x200000);
+    char *nvram = LoadFile(dir, "jv880_nvram.bin", NVRAM_SIZE);
+    if (!rom1 || !rom2 || !waverom1 || !waverom2 || !nvram)
+        return 1;
+
+    MCU *mcu = new MCU();
+    mcu->startSC55(rom1, rom2, waverom1, waverom2, nvram);
+    mcu->engine_mode = MCU_ENGINE_SCHEDULED;
+    mcu->pcm.engine = PCM_ENGINE_VECTOR;
+
+    static const unsigned int block = 512;
+    static float out_l[block], out_r[block];
+
+    // let the firmware boot before profiling
+    for (int i = 0; i < rate * 2 / (int)block; i++)
+        mcu->updateSC55WithSampleRate(out_l, out_r, block, rate);
+
+    mcu->MCU_EnableProfiler(true);
+    mcu->MCU_ResetProfiler();
+
+    // a chord every half second, released a quarter second later
+    static const uint8_t notes[] = { 48, 55, 60, 64, 67 };
+    int blocks = rate * seconds / (int)block;
+    int step = rate / 4 / (int)block;
+    for (int i = 0; i < blocks; i++)
+    {
+        if (step && i % step == 0)
+        {
+            uint8_t status = (i / step) % 2 ? 0x80 : 0x90;
+            for (uint8_t note : notes)
+            {
+                uint8_t message[3] = { status, (uint8_t)(note + (i / step / 2) % 12), 100 };
+                mcu->enqueueMidiSC55(message, 3, 0);
+            }
+        }
+        mcu->updateSC55WithSampleRate(out_l, out_r, block, rate);
+    }
+
+    FILE *report = output ? fopen(output, "w") : stdout;
+    if (!report)
+    {
+        printf("Cannot open %s\n", output);
+        return 1;
+    }
+    mcu->MCU_WriteProfile(report, format, max_addresses);
+    if (report != stdout)
+        fclose(report);
+
+    delete mcu;
+    free(rom1);
+    free(rom2);
+    free(waverom1);
+    free(waverom2);
+    free(nvram);
+    return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compares the output resamplers, MCU_Resampler at each RESAMPLER_QUALITY_*
+// and libresample with and without highQuality, on the source and host
+// rates the plugin meets. For each it prints:
+//   snr 1k   tone to noise and distortion for a 1 kHz tone, in dB
+//   snr hi   the same at 40% of the lower rate, near the band edge
+//   gain hi  level of that tone, the passband droop
+//   reject   how far a tone between the host Nyquist rate and the source
+//            one is attenuated when downsampling, the aliasing left
+//   ns       time per stereo output frame
+// The tones are at half scale. Noise and distortion are what is left after
+// fitting the tone to the output, past the filters' start-up.
+//
+// Build from the repository root, as one command:
+//   g++ -std=c++20 -O2 -ISource/emulator tools/jv880_resamplercheck.cpp
+//       Source/emulator/mcu_resampler.cpp Source/emulator/resample/*.c
+//       -o jv880_resamplercheck
+//
+// Usage: jv880_resamplercheck [-s seconds]
+// seconds of source audio per timing run, 10 by default.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "mcu_resampler.h"
+#include "resample/libresample.h"
+
+static const int block_frames = 1024; // source samples per call, as at 48 kHz
+
+// Both channels of output frames, from count source samples at src_rate
+struct Output {
+    std::vector<float> l, r;
+    double seconds = 0.0;
+};
+
+static void ToneInput(std::vector<int32_t> &in, int count, double freq, int src_rate)
+{
+    const double pi = 3.14159265358979323846;
+    in.resize(count * 2);
+    for (int i = 0; i < count; i++)
+    {
+        int32_t v = (int32_t)(sin(2.0 * pi * freq * i / src_rate) * 1073741824.0);
+        in[i * 2] = v;
+        in[i * 2 + 1] = v;
+    }
+}
+
+// quality < 0 is libresample, -1 without and -2 with highQuality
+static Output Resample(const std::vector<int32_t> &in, int src_rate, int dst_rate, int quality)
+{
+    int count = (int)in.size() / 2;
+    int max_out = (int)ceil((double)block_frames * dst_rate / src_rate) + 8;
+    Output out;
+    out.l.resize((size_t)count * dst_rate / src_rate + max_out);
+    out.r.resize(out.l.size());
+    int written = 0;
+
+    if (quality >= 0)
+    {
+        MCU_Resampler resampler;
+        if (!resampler.RESAMPLER_Open(src_rate, dst_rate, block_frames, quality))
+            return out;
+        auto start = std::chrono::steady_clock::now();
+        for (int pos = 0; pos < count; pos += block_frames)
+        {
+            int n = std::min(block_frames, count - pos);
+            written += resampler.RESAMPLER_Process((const int32_t (*)[2])&in[pos * 2], n,
+                &out.l[written], &out.r[written], max_out);
+        }
+        out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    else
+    {
+        // as MCU::updateSC55WithSampleRate does it, a float buffer for each
+        // channel and a handle each
+        double ratio = (double)dst_rate / src_rate;
+        void *handle[2] = { resample_open(quality == -2, ratio, ratio), resample_open(quality == -2, ratio, ratio) };
+        std::vector<float> buffer[2];
+        buffer[0].resize(block_frames);
+        buffer[1].resize(block_frames);
+        float *dst[2] = { out.l.data(), out.r.data() };
+        int outs[2] = {};
+        auto start = std::chrono::steady_clock::now();
+        for (int pos = 0; pos < count; pos += block_frames)
+        {
+            int n = std::min(block_frames, count - pos);
+            for (int c = 0; c < 2; c++)
+            {
+                for (int i = 0; i < n; i++)
+                    buffer[c][i] = in[(pos + i) * 2 + c] * (1.0f / 2147483648.0f);
+                int used = 0;
+                int done = 0;
+                while (done < n)
+                {
+                    int o = resample_process(handle[c], ratio, &buffer[c][done], n - done, 0, &used,
+                        dst[c] + outs[c], max_out);
+                    outs[c] += o;
+                    done += used;
+                    if (!used && !o)
+                        break;
+                }
+            }
+        }
+        out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        written = std::min(outs[0], outs[1]);
+        resample_close(handle[0]);
+        resample_close(handle[1]);
+    }
+
+    out.l.resize(written);
+    out.r.resize(written);
+    return out;
+}
+
+// Fits a cos + b sin + c at freq to the left channel from skip on, returns
+// the tone level relative to half scale and the tone to residual ratio,
+// both in dB
+static void FitTone(const std::vector<float> &y, int skip, double freq, int rate, double *gain, double *snr)
+{
+    const double pi = 3.14159265358979323846;
+    double w = 2.0 * pi * freq / rate;
+    int n = (int)y.size() - skip;
+    if (n < 1000)
+    {
+        *gain = *snr = NAN;
+        return;
+    }
+
+    // normal equations of the three parameters
+    double m[3][4] = {};
+    for (int i = skip; i < (int)y.size(); i++)
+    {
+        double b[3] = { cos(w * i), sin(w * i), 1.0 };
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+                m[r][c] += b[r] * b[c];
+            m[r][3] += b[r] * y[i];
+        }
+    }
+    for (int p = 0; p < 3; p++)
+        for (int r = 0; r < 3; r++)
+        {
+            if (r == p)
+                continue;
+            double f = m[r][p] / m[p][p];
+            for (int c = 0; c < 4; c++)
+                m[r][c] -= f * m[p][c];
+        }
+    double a = m[0][3] / m[0][0], bs = m[1][3] / m[1][1], dc = m[2][3] / m[2][2];
+
+    double tone = 0.0, residual = 0.0;
+    for (int i = skip; i < (int)y.size(); i++)
+    {
+        double t = a * cos(w * i) + bs * sin(w * i);
+        double e = y[i] - t - dc;
+        tone += t * t;
+        residual += e * e;
+    }
+    *gain = 20.0 * log10(sqrt(a * a + bs * bs) / 0.5);
+    *snr = 10.0 * log10(tone / std::max(residual, 1e-30));
+}
+
+static double Rms(const std::vector<float> &y, int skip)
+{
+    double sum = 0.0;
+    for (int i = skip; i < (int)y.size(); i++)
+        sum += (double)y[i] * y[i];
+    return y.size() > (size_t)skip ? sqrt(sum / (y.size() - skip)) : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 10;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            seconds = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("Usage: %s [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    static const int rates[][2] = {
+        { 64000, 44100 }, { 64000, 48000 }, { 64000, 96000 }, { 32000, 44100 }, { 32000, 48000 },
+    };
+    static const struct {
+        const char *name;
+        int quality;
+    } resamplers[] = {
+        { "draft", RESAMPLER_QUALITY_DRAFT },
+        { "normal", RESAMPLER_QUALITY_NORMAL },
+        { "mastering", RESAMPLER_QUALITY_MASTERING },
+        { "libresample", -1 },
+        { "libresample hq", -2 },
+    };
+
+    std::vector<int32_t> in;
+    for (const auto &rate : rates)
+    {
+        int src_rate = rate[0], dst_rate = rate[1];
+        double hi = 0.4 * std::min(src_rate, dst_rate);
+        // halfway between the host Nyquist rate and the source one
+        double stop = 0.25 * (src_rate + dst_rate);
+        int skip = dst_rate / 10;
+
+        printf("%d Hz to %d Hz\n", src_rate, dst_rate);
+        printf("  %-16s %8s %8s %8s %8s %8s\n", "", "snr 1k", "snr hi", "gain hi", "reject", "ns");
+        for (const auto &r : resamplers)
+        {
+            double gain, snr_1k, snr_hi, gain_hi;
+            ToneInput(in, src_rate, 1000.0, src_rate);
+            FitTone(Resample(in, src_rate, dst_rate, r.quality).l, skip, 1000.0, dst_rate, &gain, &snr_1k);
+            ToneInput(in, src_rate, hi, src_rate);
+            FitTone(Resample(in, src_rate, dst_rate, r.quality).l, skip, hi, dst_rate, &gain_hi, &snr_hi);
+
+            char reject[16] = "-";
+            if (dst_rate < src_rate)
+            {
+                ToneInput(in, src_rate, stop, src_rate);
+                double rms = Rms(Resample(in, src_rate, dst_rate, r.quality).l, skip);
+                snprintf(reject, sizeof(reject), "%.1f", 20.0 * log10(std::max(rms, 1e-12) / (0.5 / sqrt(2.0))));
+            }
+
+            ToneInput(in, src_rate * seconds, 1000.0, src_rate);
+            Output timed = Resample(in, src_rate, dst_rate, r.quality);
+            double ns = timed.l.empty() ? NAN : timed.seconds * 1e9 / timed.l.size();
+
+            printf("  %-16s %8.1f %8.1f %8.2f %8s %8.1f\n", r.name, snr_1k, snr_hi, gain_hi, reject, ns);
+        }
+        printf("\n");
+    }
+    return 0;
+}